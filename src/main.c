@@ -6,13 +6,20 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imstb_rectpack.h"
 
 #define WINDOW_WIDTH 1280
 #define WINDOW_HEIGHT 720
 #define FONT "fixedsys.ttf"
 
-SDL_Window *window;
-SDL_Renderer *renderer;
 TTF_Font *font;
 
 void HandleSDLError(const char *context) {
@@ -25,20 +32,13 @@ void InitSDL() {
     HandleSDLError("SDL_Init");
   }
 
-  window = SDL_CreateWindow("SDL Window", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_SHOWN);
-  if (!window) {
-    HandleSDLError("SDL_CreateWindow");
-  }
-
-  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-  if (!renderer) {
-    HandleSDLError("SDL_CreateRenderer");
-  }
-
   if (TTF_Init() < 0) {
     HandleSDLError("TTF_Init");
   }
 
+  // Loaded up front, rather than by the first decoder to need them.
+  IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG);
+
   font = TTF_OpenFont(FONT, 16);
 }
 
@@ -63,14 +63,148 @@ typedef double f64;
 #define UI_MAX_STATE 1024
 #define UI_MAX_ALIGN 1024
 #define UI_MAX_STORAGE 10000
+#define UI_MAX_MEMO 256
+#define UI_MAX_MEMO_CMD 4096
+#define UI_MAX_RENDER_CACHE 64
+#define UI_MAX_NODE 64
+#define UI_MAX_IMAGE 1024
+#define UI_MAX_IMAGE_BYTES (64 << 20)
+#define UI_FRAME_ARENA_SIZE (16 << 10)
+#define UI_SCROLL_STEP 40
+#define UI_OCCLUSION_TILE 16
+
+// UI Allocation Audit
+
+#define UI_MAX_ALLOC_SITE 32
+
+// The library allocates through these, so the audit can tell where from.
+#define UI_Malloc(size) (ui_alloc_line = __LINE__, SDL_malloc(size))
+#define UI_Calloc(count, size) (ui_alloc_line = __LINE__, SDL_calloc(count, size))
+#define UI_Realloc(ptr, size) (ui_alloc_line = __LINE__, SDL_realloc(ptr, size))
+
+typedef struct {
+  // The line in this file, or 0 for SDL's own allocations.
+  i32 line;
+  i32 allocs;
+  u64 bytes;
+} UI_AllocSite;
+
+typedef struct {
+  // Reallocs count as allocations, of the new size.
+  i32 allocs;
+  i32 frees;
+  u64 bytes;
+  // Sites past UI_MAX_ALLOC_SITE are only counted in the totals.
+  UI_AllocSite sites[UI_MAX_ALLOC_SITE];
+  i32 sites_length;
+} UI_AllocStats;
+
+// Set by the macros above, consumed by the next allocation on the thread.
+_Thread_local i32 ui_alloc_line = 0;
+
+// Process wide, as SDL's memory functions are.
+SDL_SpinLock ui_alloc_lock = 0;
+UI_AllocStats ui_alloc_stats = {0};
+bool ui_alloc_audit = false;
+SDL_malloc_func ui_real_malloc;
+SDL_calloc_func ui_real_calloc;
+SDL_realloc_func ui_real_realloc;
+SDL_free_func ui_real_free;
+
+void UI_CountAlloc(size_t size) {
+  i32 line = ui_alloc_line;
+  ui_alloc_line = 0;
+
+  SDL_AtomicLock(&ui_alloc_lock);
+  UI_AllocStats *stats = &ui_alloc_stats;
+  stats->allocs++;
+  stats->bytes += size;
+  i32 i = 0;
+  while (i < stats->sites_length && stats->sites[i].line != line) {
+    i++;
+  }
+  if (i == stats->sites_length && i < UI_MAX_ALLOC_SITE) {
+    stats->sites[stats->sites_length++] = (UI_AllocSite){.line = line};
+  }
+  if (i < stats->sites_length) {
+    stats->sites[i].allocs++;
+    stats->sites[i].bytes += size;
+  }
+  SDL_AtomicUnlock(&ui_alloc_lock);
+}
+
+void *UI_AuditMalloc(size_t size) {
+  UI_CountAlloc(size);
+  return ui_real_malloc(size);
+}
+
+void *UI_AuditCalloc(size_t count, size_t size) {
+  UI_CountAlloc(count * size);
+  return ui_real_calloc(count, size);
+}
+
+void *UI_AuditRealloc(void *ptr, size_t size) {
+  UI_CountAlloc(size);
+  return ui_real_realloc(ptr, size);
+}
+
+void UI_AuditFree(void *ptr) {
+  if (ptr != NULL) {
+    SDL_AtomicLock(&ui_alloc_lock);
+    ui_alloc_stats.frees++;
+    SDL_AtomicUnlock(&ui_alloc_lock);
+  }
+  ui_real_free(ptr);
+}
+
+// Counts every allocation made through SDL's memory functions, by the library
+// and by SDL itself, until the process exits. The previous functions are
+// still used underneath, so memory allocated before is freed correctly, but
+// call first thing to have the counts cover everything.
+bool UI_InstallAllocAudit() {
+  if (ui_alloc_audit) {
+    return true;
+  }
+  SDL_GetMemoryFunctions(&ui_real_malloc, &ui_real_calloc, &ui_real_realloc, &ui_real_free);
+  if (SDL_SetMemoryFunctions(UI_AuditMalloc, UI_AuditCalloc, UI_AuditRealloc, UI_AuditFree) < 0) {
+    return false;
+  }
+  ui_alloc_audit = true;
+  return true;
+}
+
+// Returns the counts since the last call, and starts counting anew. Called
+// once a frame, for that frame's allocations.
+UI_AllocStats UI_TakeAllocStats() {
+  SDL_AtomicLock(&ui_alloc_lock);
+  UI_AllocStats stats = ui_alloc_stats;
+  ui_alloc_stats = (UI_AllocStats){0};
+  SDL_AtomicUnlock(&ui_alloc_lock);
+  return stats;
+}
+
+void UI_PrintAllocStats(i32 frame, const UI_AllocStats *stats) {
+  printf("[Alloc]: frame %d made %d allocations of %llu bytes, and %d frees\n",
+         frame, stats->allocs, (unsigned long long)stats->bytes, stats->frees);
+  for (i32 i = 0; i < stats->sites_length; i++) {
+    const UI_AllocSite *site = &stats->sites[i];
+    if (site->line == 0) {
+      printf("  SDL: %d of %llu bytes\n", site->allocs, (unsigned long long)site->bytes);
+    } else {
+      printf("  %s:%d: %d of %llu bytes\n", __FILE__, site->line, site->allocs,
+             (unsigned long long)site->bytes);
+    }
+  }
+}
 
 // UI Hash
 
+#define UI_HASH_SEED 2166136261u
+
 // FNV-1a hash.
 // https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
-u32 ui_hash(const void *data, size_t len) {
+u32 ui_hash_combine(u32 hash, const void *data, size_t len) {
   const u8 *bytes = (const u8 *)data;
-  u32 hash = 2166136261u;
   for (size_t i = 0; i < len; ++i) {
     hash ^= bytes[i];
     hash *= 16777619u;
@@ -78,6 +212,10 @@ u32 ui_hash(const void *data, size_t len) {
   return hash;
 }
 
+u32 ui_hash(const void *data, size_t len) {
+  return ui_hash_combine(UI_HASH_SEED, data, len);
+}
+
 // UI Alignment Types
 
 typedef enum {
@@ -94,6 +232,61 @@ typedef union {
     Rect bounds;
     i32 x_offset;
   } align;
+  struct {
+    // Hash of the inputs the cached range was built from.
+    u32 inputs_hash;
+    // The frame the cached range was recorded on.
+    u32 frame;
+    // The layout position the cached range was built at.
+    v2 origin;
+    // The layout bounds of the cached range.
+    Rect bounds;
+    // The union of the cached cmds' rects, as clamped to the coordinate range.
+    Rect extent;
+    // The cached range in ui_ctx->memo_cache.
+    i32 cache_index;
+    i32 length;
+    // The clip rect the cached range was culled against.
+    Rect clip;
+    // The value of ui_ctx->emit_culled when the subtree began.
+    i32 emit_culled;
+    // The number of cmds culled from the cached range, including those of
+    // replayed child subtrees.
+    i32 culled;
+    // The hovered and active widgets when the range was recorded.
+    u32 hover_id;
+    u32 active_id;
+    // The value of ui_ctx->tweens.touched when the subtree began.
+    i32 touched;
+    // True if tweens were running in the cached range.
+    bool animating;
+    // For deferred subtrees, the frame it was last built on, how long that
+    // took in ms, and the frame it's planned to be built on.
+    u32 built;
+    f32 cost;
+    u32 planned;
+    u64 build_start;
+  } memo;
+  struct {
+    // The scroll position of the content.
+    v2 offset;
+    // The content size, as of last frame.
+    v2 content;
+    // The viewport size.
+    v2 size;
+  } scroll;
+  struct {
+    // Drawn pixels per source pixel, 0 until first drawn.
+    f32 scale;
+    // The position of the viewport in the zoomed image.
+    v2 offset;
+    bool dragging;
+    v2 drag_pos;
+  } tiled;
+  struct {
+    // The tween's index + 1, 0 until it's created.
+    i32 slot;
+  } tween;
 } UI_Data;
 
 typedef struct {
@@ -101,57 +294,92 @@ typedef struct {
   UI_Data data;
 } UI_StorageEntry;
 
-UI_StorageEntry ui_storage[UI_MAX_STORAGE] = {0};
-
-UI_Data *ui_get_data(u32 id) {
-  for (i32 i = 0; i < UI_MAX_STORAGE; i++) {
-    u32 index = (id + i) % UI_MAX_STORAGE;
-    if (ui_storage[index].id == 0 || ui_storage[index].id == id) {
-      ui_storage[index].id = id;
-      return &ui_storage[index].data;
-    }
-    printf("Storage cache miss [%u]: 0x%x\n", index, id);
-  }
-
-  assert(false);
-}
-
 // UI Draw Command
 
 typedef enum {
   UI_RECT,
+  // Has a payload, the fill color.
   UI_BUTTON,
   UI_PANEL,
+  // Has a payload, the image.
   UI_IMAGE,
+  // Has a payload, the fill color.
+  UI_FILL,
+  // Begins a clipped scroll region, the rect is the viewport.
+  UI_CLIP,
+  // Ends a clipped scroll region, the rect is the scrolled content bounds.
+  // Has a payload, the scroll offset.
+  UI_UNCLIP,
 } UI_DrawCmdType;
 
+typedef union {
+  void *image;
+  v2 offset;
+  UI_Color color;
+} UI_DrawPayload;
+
+// An unpacked draw cmd.
 typedef struct {
   u32 id;
   UI_DrawCmdType type;
   Rect rect;
-  void* image;
+  // Zeroed for types without a payload.
+  UI_DrawPayload payload;
 } UI_DrawCmd;
 
-// UI Draw Queue
+bool UI_DrawCmdHasPayload(UI_DrawCmdType type) {
+  return type == UI_BUTTON || type == UI_IMAGE || type == UI_FILL || type == UI_UNCLIP;
+}
 
-UI_DrawCmd ui_draw_queue[UI_MAX_DRAW_CMD] = {};
-i32 ui_draw_queue_length = 0;
+// UI Draw Queue
 
-UI_DrawCmd *UI_PushDrawCmd() {
-  assert(ui_draw_queue_length < UI_MAX_DRAW_CMD);
+// Coordinates are stored in 16 bits. Rects are clamped to this guard band,
+// which is far enough outside of the window not to change what's drawn.
+#define UI_COORD_MIN -16384
+#define UI_COORD_MAX 16383
 
-  return &ui_draw_queue[ui_draw_queue_length++];
-}
+// Stored as a structure of arrays, so passes over the rects (culling, hit
+// testing, bounds) stream through tightly packed lanes. Payloads, which only
+// some types have, live in a side array.
+typedef struct {
+  i32 length;
+  i32 capacity;
+  u32 *id;
+  u8 *type;
+  i16 *x;
+  i16 *y;
+  i16 *w;
+  i16 *h;
+  // Index into payloads, or -1.
+  i32 *payload;
+  UI_DrawPayload *payloads;
+  i32 payloads_length;
+} UI_DrawQueue;
 
-// UI State
+// UI Hit Index
 
-// UI Focus State
+#define UI_HIT_CELL 64
+#define UI_HIT_COLUMNS ((WINDOW_WIDTH + UI_HIT_CELL - 1) / UI_HIT_CELL)
+#define UI_HIT_ROWS ((WINDOW_HEIGHT + UI_HIT_CELL - 1) / UI_HIT_CELL)
+#define UI_HIT_CELLS (UI_HIT_COLUMNS * UI_HIT_ROWS)
+// The cell entries reserved per cmd up front, they grow as needed.
+#define UI_HIT_ENTRIES_PER_RECT 8
 
-i32 ui_window_id = 0;
-i32 ui_hover_id = 0;
-i32 ui_active_id = 0;
-// When true, the hover id can be overriden. Useful for overlapping buttons.
-bool ui_hover_greedy = false;
+// A uniform grid over the window, holding last frame's interactive rects,
+// and the opaque rects drawn over them, which block with id 0. Each cell
+// lists the rects touching it in emission order, so the last one containing
+// a point is the topmost.
+typedef struct {
+  i32 length;
+  i32 capacity;
+  u32 *id;
+  // Clipped to the window and the enclosing scroll regions.
+  Rect *rect;
+  // Cell c owns entries [cells[c], cells[c + 1]).
+  i32 cells[UI_HIT_CELLS + 1];
+  i32 *entries;
+  i32 entries_capacity;
+} UI_HitIndex;
 
 // UI Input State
 
@@ -162,16 +390,55 @@ typedef enum {
 
 typedef struct {
   v2 mouse_pos;
-  u8 mouse_button_down;
-  u8 mouse_button_up;
+  v2 mouse_wheel;
 } UI_InputState;
 
 const UI_InputState ui_default_input_state = {
   .mouse_pos = {0, 0},
-  .mouse_button_down = 0,
-  .mouse_button_up = 0,
+  .mouse_wheel = {0, 0},
 };
-UI_InputState ui_input_state = ui_default_input_state;
+
+// UI Input Events
+
+#define UI_MAX_INPUT_EVENT 256
+
+typedef enum {
+  UI_INPUT_MOUSE_DOWN,
+  UI_INPUT_MOUSE_UP,
+  // Only timed for latency, the pointer and wheel are read from the input
+  // state. pos is where the pointer moved, or was.
+  UI_INPUT_MOUSE_MOVE,
+  UI_INPUT_MOUSE_WHEEL,
+  UI_INPUT_KEY,
+} UI_InputEventType;
+
+typedef struct {
+  UI_InputEventType type;
+  UI_MouseButton button;
+  v2 pos;
+  // When SDL received the event, in SDL_GetTicks() time.
+  u32 timestamp;
+} UI_InputEvent;
+
+// UI Latency
+
+// One bucket per ms, the last also counts anything slower.
+#define UI_LATENCY_BUCKETS 256
+
+typedef enum {
+  // The event was resolved at the start of a build.
+  UI_LATENCY_HANDLED,
+  // The frame reflecting the event was built.
+  UI_LATENCY_BUILT,
+  // SDL_RenderPresent() returned for that frame.
+  UI_LATENCY_PRESENTED,
+  UI_LATENCY_STAGE_COUNT,
+} UI_LatencyStage;
+
+typedef struct {
+  u32 count;
+  u32 buckets[UI_LATENCY_BUCKETS];
+} UI_LatencyHistogram;
 
 // UI Layout State
 
@@ -193,6 +460,8 @@ typedef struct {
   v2 margin;
   // The padding for components.
   v2 padding;
+  // Widgets fully outside of the clip rect are culled.
+  Rect clip;
 } UI_State;
 
 const UI_State ui_default_state = {
@@ -202,349 +471,5237 @@ const UI_State ui_default_state = {
   .bounds = {0, 0, 0, 0},
   .margin = {10, 10},
   .padding = {10, 10},
+  .clip = {0, 0, WINDOW_WIDTH, WINDOW_HEIGHT},
 };
 
-UI_State ui_state_stack[1024] = { ui_default_state };
-i32 ui_state_stack_length = 0;
-UI_State *ui = ui_state_stack;
+// UI Culling Stats
 
-void UI_Clear() {
-  ui_draw_queue_length = 0;
-  ui_state_stack_length = 0;
-  ui = &ui_state_stack[ui_state_stack_length];
-  *ui = ui_default_state;
-}
+typedef struct {
+  // Cmds left in the draw queue.
+  i32 visible;
+  // Cmds dropped for being outside the window or their clip rect.
+  i32 culled;
+  // Cmds trimmed to the visible part of their rect.
+  i32 trimmed;
+  // Cmds dropped for being hidden behind opaque cmds.
+  i32 occluded;
+} UI_CullStats;
 
-void UI_PushState() {
-  assert(ui_state_stack_length < UI_MAX_STATE);
+// UI Late Latch Stats
 
-  ui[1] = ui[0];
-  ui_state_stack_length++;
-  ui++;
-}
+typedef struct {
+  i32 count;
+  // Summed time from sampling the pointer to presenting, in ms, for the
+  // sample taken before building and the late latched one.
+  f64 early;
+  f64 late;
+} UI_LatchStats;
 
-void UI_PopState() {
-  assert(ui_state_stack_length > 0);
+// UI Frame Arena
 
-  ui_state_stack_length--;
-  ui--;
-}
+#define UI_ARENA_ALIGN 16
 
-// UI Layout
+typedef struct UI_ArenaOverflow {
+  struct UI_ArenaOverflow *next;
+} UI_ArenaOverflow;
 
-void UI_UpdateLayout(Rect *rect) {
-  switch (ui->layout) {
-    case UI_LAYOUT_HORIZONTAL:
-      ui->pos.x += rect->w + ui->margin.x;
-      break;
-    case UI_LAYOUT_VERTICAL:
-      ui->pos.y += rect->h + ui->margin.y;
-      break;
-  }
-  if (ui->bounds.x + ui->bounds.w < rect->x + rect->w) {
-    ui->bounds.w = rect->x + rect->w - ui->bounds.x;
-  }
-  if (ui->bounds.y + ui->bounds.h < rect->y + rect->h) {
-    ui->bounds.h = rect->y + rect->h - ui->bounds.y;
-  }
-}
+// Memory that lasts as long as a frame: allocated while building, read until
+// the frame is rendered, and reset when the frame is next built. After a few
+// frames the block fits the most any frame used, and nothing is allocated.
+typedef struct {
+  u8 *base;
+  size_t capacity;
+  size_t used;
+  // Allocated one by one when the block is full, freed on reset, when the
+  // block is grown to fit them from then on.
+  UI_ArenaOverflow *overflow;
+  size_t overflow_bytes;
+  // The most used by one frame.
+  size_t high_water;
+} UI_Arena;
 
-// UI Utils
+// UI Frame
 
-bool UI_MouseInRect(Rect *rect) {
-  v2 *mouse_pos = &ui_input_state.mouse_pos;
-  if (mouse_pos->x >= rect->x && mouse_pos->x <= rect->x + rect->w &&
-      mouse_pos->y >= rect->y && mouse_pos->y <= rect->y + rect->h) {
-    return true;
-  }
+// A built frame, with everything the renderer reads of it. Frames are handed
+// from the build to the renderer, so the two can run on separate threads.
+typedef struct {
+  UI_DrawQueue draw_queue;
+  UI_HitIndex hit_index;
+  // Captured at the end of the build, then updated by the late latch.
+  u32 hover_id;
+  u32 active_id;
+  u32 frame;
+  UI_CullStats cull_stats;
+  i32 emit_culled;
+  // The deferred subtrees replayed rather than built.
+  i32 deferred;
+  // Performance counter times of the pointer sample the frame was built
+  // from, and of the late latched one.
+  u64 sample_time;
+  u64 latch_time;
+  // The timestamps of the input events resolved by the frame, and by the
+  // frame it replaced before that was presented.
+  u32 *event_times;
+  i32 event_times_length;
+  // When each stage was reached, in SDL_GetTicks() time.
+  u32 latency_ticks[UI_LATENCY_STAGE_COUNT];
+  // See UI_FrameAlloc().
+  UI_Arena arena;
+} UI_Frame;
 
-  return false;
-}
+// Set in a triple buffer's mailbox when it holds a slot the reader hasn't
+// taken.
+#define UI_SLOT_FRESH 0x100
 
-// UI Alignment
-// typedef struct {
-//   i32 start_index;
-//   v2 start_pos;
-//   UI_Align align;
-// } UI_AlignInfo;
-// 
-const u8 *ui_align_stack[UI_MAX_ALIGN];
-i32 ui_align_stack_length = 0;
+// UI Overlay Buffers
 
-void UI_BeginAlign(UI_Align align, const u8 *label) {
-  ui_align_stack[ui_align_stack_length++] = label;
-  u32 id = ui_hash(label, strlen(label));
-  UI_Data *data = ui_get_data(id);
-  data->align.start_index = ui_draw_queue_length;
-  data->align.align = align;
+#define UI_MAX_OVERLAY_BUFFER 16
+#define UI_MAX_OVERLAY_CMD 256
 
-  UI_PushState();
-  ui->pos.x += data->align.x_offset;
-  ui->bounds.w = 0;
-  ui->bounds.h = 0;
-}
+typedef struct {
+  u32 layer;
+  u32 key;
+  UI_DrawCmd cmd;
+} UI_OverlayCmd;
 
-void UI_EndAlign() {
-  const u8 *label = ui_align_stack[--ui_align_stack_length];
-  u32 id = ui_hash(label, strlen(label));
-  UI_Data *data = ui_get_data(id);
-  data->align.bounds = ui->bounds;
-  UI_PopState();
+// Starts at UI_MAX_OVERLAY_CMD cmds, and grows as needed.
+typedef struct {
+  UI_OverlayCmd *cmds;
+  i32 length;
+  i32 capacity;
+} UI_OverlayBatch;
 
-  // TODO: Remove if, find a better way to stabilize.
-  if (data->align.x_offset == 0) {
-    switch (data->align.align) {
-      case UI_ALIGN_LEFT: {
-        i32 x = data->align.bounds.x;
-        data->align.x_offset = ui->bounds.x - x;
-      } break;
-      case UI_ALIGN_RIGHT: {
-        i32 x = data->align.bounds.x + data->align.bounds.w;
-        data->align.x_offset = ui->bounds.x + ui->bounds.w - x;
-      } break;
-    }
-  }
-  //printf("h = %d\n", data->align.bounds.h);
-  ui->bounds.h += data->align.bounds.h - ui->bounds.h;
-}
+// Overlay cmds recorded by one thread, outside of the build. Batches pass
+// through three slots like frames: the one being recorded, the newest
+// submitted one, and the one being merged, so neither side takes a lock.
+typedef struct {
+  UI_OverlayBatch batches[3];
+  UI_OverlayBatch *record;
+  UI_OverlayBatch *merge;
+  SDL_atomic_t mailbox;
+  // Cmds dropped for being out of memory, only touched by the recording
+  // thread.
+  i32 dropped;
+} UI_OverlayBuffer;
 
-// UI Widgets
+// UI Nodes
 
-// UI Rect
+// A panel at a fixed position, so its layout doesn't depend on its siblings.
+// A tree of nodes is built in parallel, each node on its own context.
+typedef struct UI_Node {
+  // Unique among its siblings.
+  const char *label;
+  v2 pos;
+  // Builds the panel's content, with the node's context current.
+  void (*build)(void *data);
+  void *data;
+  struct UI_Node *children;
+  i32 children_length;
+} UI_Node;
 
-void UI_Rect(i32 w, i32 h) {
-  UI_DrawCmd *cmd = UI_PushDrawCmd();
-  cmd->type = UI_RECT;
-  cmd->rect = (Rect){ui->pos.x, ui->pos.y, w, h};
+typedef struct UI_Context UI_Context;
+typedef struct UI_ThreadPool UI_ThreadPool;
 
-  UI_UpdateLayout(&cmd->rect);
-}
+// Kept across frames, so the node's storage and memo cache persist.
+typedef struct {
+  u32 id;
+  UI_Context *ctx;
+} UI_NodeContext;
 
-// UI Button
+typedef struct {
+  UI_Node *node;
+  UI_Context *ctx;
+  UI_Context *parent;
+  // Where its cmds and payloads go in the parent's draw queue.
+  i32 offset;
+  i32 payload_offset;
+} UI_NodeBuild;
 
-bool UI_Button(const char *label) {
-  u32 id = ui_hash(label, strlen(label));
-  UI_DrawCmd *cmd = UI_PushDrawCmd();
-  cmd->id = id;
-  cmd->type = UI_BUTTON;
-  cmd->rect = (Rect){ui->pos.x, ui->pos.y, 100, 50};
-  
-  bool clicked = false;
-  if (UI_MouseInRect(&cmd->rect)) {
-    // Grab hover id if possible.
-    if (ui_hover_id == 0 || ui_hover_greedy) {
-      ui_hover_id = id;
-    }
+// UI Images
 
-    // Set active if mouse down and hovered, and nothing else is active.
-    if (ui_active_id == 0 && ui_hover_id == id && ui_input_state.mouse_button_down & UI_MOUSE_BUTTON_LEFT) {
-      ui_active_id = id;
-    }
+// Decodes in flight per cache, more requests wait for a later frame.
+#define UI_MAX_IMAGE_DECODE 32
+// Bytes uploaded per rendered frame, so a burst of decodes is spread over
+// several frames. At least one image is uploaded.
+#define UI_IMAGE_UPLOAD_BYTES (4 << 20)
 
-    // Detect click, if active.
-    if (ui_active_id == id && ui_input_state.mouse_button_up & UI_MOUSE_BUTTON_LEFT) {
-      clicked = true;
-      ui_active_id = 0;
-    }
+typedef enum {
+  UI_IMAGE_EMPTY,
+  // The slot is being filled in by the thread that claimed it.
+  UI_IMAGE_CLAIMED,
+  // Not decoded yet, or evicted.
+  UI_IMAGE_UNLOADED,
+  UI_IMAGE_DECODING,
+  // Decoded into surface, waiting for the renderer to upload it.
+  UI_IMAGE_DECODED,
+  UI_IMAGE_LOADED,
+  UI_IMAGE_FAILED,
+} UI_ImageState;
 
-  } else {
-    // Release hover id.
-    if (ui_hover_id == id) {
-      ui_hover_id = 0;
-    }
+typedef struct UI_ImageCache UI_ImageCache;
 
-    // Release active id, if mouse released outside of button.
-    if (ui_active_id == id && ui_input_state.mouse_button_up & UI_MOUSE_BUTTON_LEFT) {
-      ui_active_id = 0;
-    }
-  }
+#define UI_TILE_SIZE 256
+#define UI_MAX_TILE_LEVEL 16
+#define UI_MAX_TILE_SOURCE 8
+// The wheel zooms in or out by this per notch.
+#define UI_TILED_ZOOM_STEP 1.25f
+#define UI_TILED_MAX_SCALE 8.0f
 
-  UI_UpdateLayout(&cmd->rect);
-  return clicked;
-}
+// A large image, drawn a tile at a time. Level l is downsampled 2^l times,
+// the last level fits in one tile.
+typedef struct {
+  i32 width, height;
+  // Mapped from the file, only the pages of tiles decoded are read in.
+  const u32 *pixels;
+  size_t size;
+  i32 levels;
+  // The tiles of level l are [level_tiles[l], level_tiles[l + 1]) in a tile
+  // set, row major.
+  i32 level_tiles[UI_MAX_TILE_LEVEL + 1];
+  i32 columns[UI_MAX_TILE_LEVEL];
+  i32 rows[UI_MAX_TILE_LEVEL];
+} UI_TileSource;
 
-// UI Panel
+// An image at one size. Requested by the build, decoded by a worker, then
+// uploaded and evicted by the renderer, each handing it on through state.
+typedef struct {
+  SDL_atomic_t state;
+  UI_ImageCache *cache;
+  u32 id;
+  char *path;
+  i32 w, h;
+  // Set for a tile, which has no path. Its top left is at tile in level
+  // pixels.
+  const UI_TileSource *source;
+  i32 level;
+  v2 tile;
+  SDL_Surface *surface;
+  // Owned by the renderer. Small images are packed into an atlas page, at
+  // src, the rest have a texture of their own and page -1.
+  SDL_Texture *texture;
+  i32 page;
+  Rect src;
+  i32 bytes;
+  // The last frame it was rendered in, for eviction.
+  u32 rendered;
+  // Incremented when the texture's pixels change in place.
+  u32 version;
+} UI_ImageEntry;
 
-void UI_BeginPanel() {
-  UI_PushState();
+#define UI_ATLAS_PAGE_SIZE 1024
+#define UI_MAX_ATLAS_PAGE 8
+// Larger images get a texture of their own.
+#define UI_ATLAS_MAX_IMAGE 128
+#define UI_MAX_IMAGE_BATCH 256
 
-  // Start of panel. Store the index, and create rect cmd, which we'll adjust
-  // later in UI_EndPanel().
-  ui->bounds.x = ui->pos.x;
-  ui->bounds.y = ui->pos.y;
-  ui->bounds.w = 0;
-  ui->bounds.h = 0;
-  ui->index = ui_draw_queue_length;
-  ui->pos.x += ui->padding.x;
-  ui->pos.y += ui->padding.y;
-  {
-    UI_DrawCmd *cmd = UI_PushDrawCmd();
-    cmd->type = UI_PANEL;
-  }
-}
+typedef struct {
+  SDL_Texture *texture;
+  // Packs images in as they're uploaded. Evicted images leave holes, which
+  // are only reclaimed by defragmenting the page.
+  stbrp_context packer;
+  stbrp_node nodes[UI_ATLAS_PAGE_SIZE];
+  // The area of the live images.
+  i32 used;
+} UI_AtlasPage;
 
-void UI_EndPanel() {
-  UI_DrawCmd *cmd = &ui_draw_queue[ui->index];
-  cmd->rect = ui->bounds;
-  cmd->rect.w += ui->padding.x;
-  cmd->rect.h += ui->padding.y;
+#define UI_MAX_STREAM 8
+#define UI_MAX_STREAM_DIRTY 16
 
-  UI_PopState();
-  UI_UpdateLayout(&cmd->rect);
-}
+typedef struct {
+  // Locked by the producer.
+  u32 frames;
+  // Made by UI_UpdateStream(), on top of the upload.
+  u32 copies;
+  // Rects and bytes copied into the texture.
+  u32 uploads;
+  u64 bytes;
+} UI_StreamStats;
 
-// END UI library
+// Live pixels from another thread, e.g. camera frames. SDL textures can only
+// be locked on the rendering thread, so the producer writes into pixels, and
+// the renderer copies the rects it changed into the streaming texture before
+// the frame that draws it.
+typedef struct {
+  // Drawn like any image, but never evicted.
+  UI_ImageEntry image;
+  u32 *pixels;
+  i32 pitch;
+  // Guards pixels, the dirty rects and stats.
+  SDL_SpinLock lock;
+  Rect dirty[UI_MAX_STREAM_DIRTY];
+  i32 dirty_length;
+  UI_StreamStats stats;
+} UI_Stream;
 
-// UI Renderer
+// The tiles of one source, each cache has its own set for a source.
+typedef struct {
+  const UI_TileSource *source;
+  UI_ImageEntry *tiles;
+} UI_TileSet;
 
-void UI_Render() {
-  for (i32 i = 0; i < ui_draw_queue_length; i++) {
-    UI_DrawCmd *cmd = &ui_draw_queue[i];
-    switch (cmd->type) {
-      case UI_RECT:
-        SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-        SDL_RenderFillRect(renderer, (Rect*)&cmd->rect);
-        break;
-      case UI_BUTTON:
-        UI_Color color = {0, 0, 0, 255};
-        if (ui_active_id == cmd->id) {
-          color.b = 200;
-        } else if (ui_hover_id == cmd->id) {
-          color.b = 150;
-        } else {
-          color.b = 100;
-        }
-        SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
-        SDL_RenderFillRect(renderer, (Rect*)&cmd->rect);
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderDrawRect(renderer, (Rect*)&cmd->rect);
-        break;
-      case UI_PANEL:
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderFillRect(renderer, (Rect*)&cmd->rect);
-        break;
-      case UI_IMAGE:
-        SDL_RenderCopy(renderer, cmd->image, NULL, (Rect*)&cmd->rect);
-        break;
-    }
-  }
-}
+// Consecutive images on the same page, drawn with one call.
+typedef struct {
+  SDL_Texture *texture;
+  SDL_Vertex vertices[UI_MAX_IMAGE_BATCH * 4];
+  i32 indices[UI_MAX_IMAGE_BATCH * 6];
+  i32 length;
+} UI_ImageBatch;
 
-// END UI Renderer
+struct UI_ImageCache {
+  // Open addressed by id, slots are only ever added.
+  UI_ImageEntry *entries;
+  i32 capacity;
+  // Returned for every image once entries is full, drawn as a placeholder.
+  UI_ImageEntry full;
+  // Decodes the images, without one they stay placeholders.
+  UI_ThreadPool *pool;
+  SDL_atomic_t decoding;
+  // The bytes of all textures, owned by the renderer.
+  i64 bytes;
 
-i32 main() {
-  InitSDL();
+  // Owned by the renderer.
+  UI_AtlasPage pages[UI_MAX_ATLAS_PAGE];
+  i32 pages_length;
+  UI_ImageBatch batch;
 
-  SDL_Event event;
+  // Added by the build as tiled images are first drawn, under the lock.
+  // Read by the renderer up to length.
+  UI_TileSet tile_sets[UI_MAX_TILE_SOURCE];
+  SDL_atomic_t tile_sets_length;
+  SDL_SpinLock tile_sets_lock;
 
-  // ui_draw_queue[0] = (UI_DrawCmd){
-  //   .prim = UI_RECT,
-  //   .rect = { 10, 10, 100, 50 },
-  // };
-  // ui_draw_queue[1] = (UI_DrawCmd){
-  //   .prim = UI_RECT,
-  //   .rect = { 15, 15, 100, 50 },
-  // };
-  // ui_draw_queue_length = 2;
+  UI_Stream *streams[UI_MAX_STREAM];
+  SDL_atomic_t streams_length;
+};
 
-  while (true) {
+// UI Render Cache
 
-    // Handle events.
-    ui_input_state.mouse_button_up = 0;
-    while (SDL_PollEvent(&event)) {
-      switch (event.type) {
-        case SDL_QUIT:
-          exit(0);
-        case SDL_KEYDOWN:
-          if (event.key.keysym.sym == SDLK_ESCAPE) {
-            exit(0);
-          }
-          break;
-        case SDL_MOUSEBUTTONDOWN:
-          if (event.button.button == SDL_BUTTON(SDL_BUTTON_LEFT)) {
-            ui_input_state.mouse_button_down |= UI_MOUSE_BUTTON_LEFT;
-            ui_input_state.mouse_button_up &= ~UI_MOUSE_BUTTON_LEFT;
-          }
-          if (event.button.button == SDL_BUTTON(SDL_BUTTON_RIGHT)) {
-            ui_input_state.mouse_button_down |= UI_MOUSE_BUTTON_RIGHT;
-            ui_input_state.mouse_button_up &= ~UI_MOUSE_BUTTON_RIGHT;
-          }
-          break;
-        case SDL_MOUSEBUTTONUP:
-          if (event.button.button == SDL_BUTTON(SDL_BUTTON_LEFT)) {
-            ui_input_state.mouse_button_up |= UI_MOUSE_BUTTON_LEFT;
-            ui_input_state.mouse_button_down &= ~UI_MOUSE_BUTTON_LEFT;
-          }
-          if (event.button.button == SDL_BUTTON(SDL_BUTTON_RIGHT)) {
-            ui_input_state.mouse_button_up |= UI_MOUSE_BUTTON_RIGHT;
-            ui_input_state.mouse_button_down &= ~UI_MOUSE_BUTTON_RIGHT;
-          }
-          break;
-      }
-    }
-    SDL_GetMouseState(&ui_input_state.mouse_pos.x, &ui_input_state.mouse_pos.y);
+// A rendered cmd, in the content space of a scroll region.
+typedef struct {
+  Rect rect;
+  u32 hash;
+} UI_RenderedCmd;
 
-    // Update.
-    {
-      UI_Clear();
+typedef struct {
+  UI_RenderedCmd *cmds;
+  i32 length;
+  i32 capacity;
+} UI_RenderedList;
 
-      UI_BeginPanel();
-        UI_BeginPanel();
-          ui->layout = UI_LAYOUT_VERTICAL;
-          UI_Rect(100, 50);
-          UI_Rect(100, 50);
-          UI_Rect(100, 50);
-        UI_EndPanel();
-        UI_BeginPanel();
-          ui->layout = UI_LAYOUT_HORIZONTAL;
-          UI_Rect(200, 50);
-          UI_Rect(200, 50);
-          UI_Rect(200, 50);
-          if(UI_Button("Ok")) {
-            printf("Ok\n");
-          }
-          // Cause button to overlap.
-          ui->pos.x -= 40;
-          ui_hover_greedy = true;
-          if(UI_Button("Cancel")) {
-            printf("Cancel\n");
-          }
-          ui_hover_greedy = false;
-        UI_EndPanel();
-      UI_EndPanel();
+// Scroll regions are rendered into a texture, which is reused while its
+// content is unchanged. When only the scroll offset changed, the pixels are
+// shifted and just the newly exposed strips are rasterized.
+typedef struct {
+  u32 id;
+  // The last frame the entry was used, for eviction.
+  u32 frame;
+  // Shifting needs a separate source and target, so the textures ping-pong.
+  SDL_Texture *textures[2];
+  i32 texture;
+  i32 w, h;
+  // True if textures[texture] holds rendered content.
+  bool valid;
+  // The scroll offset textures[texture] was rendered at.
+  v2 offset;
+  // The cmds in the current and previous frame.
+  UI_RenderedList lists[2];
+  i32 list;
+} UI_RenderCacheEntry;
 
+// UI Tweens
 
-      UI_BeginPanel();
-        UI_Rect(500, 20);
-        UI_BeginAlign(UI_ALIGN_LEFT, "Left Buttons");
-          if(UI_Button("Cancel#")) {
-            printf("Cancel\n");
-          }
-        UI_EndAlign();
-        UI_BeginAlign(UI_ALIGN_RIGHT, "Right Buttons");
-          ui->layout = UI_LAYOUT_HORIZONTAL;
-          if(UI_Button("Ok#")) {
-            printf("Ok\n");
-          }
-          if(UI_Button("Back#")) {
-            printf("Back\n");
-          }
-        UI_EndAlign();
-      UI_EndPanel();
+#define UI_TWEEN_CHANNELS 4
+#define UI_TWEEN_RETIRE_FRAMES 64
 
-    }
+typedef enum {
+  UI_EASE_LINEAR,
+  UI_EASE_IN,
+  UI_EASE_OUT,
+  UI_EASE_IN_OUT,
+} UI_Easing;
 
-    // Render.
-    {
-      SDL_SetRenderDrawColor(renderer, 60, 80, 40, 255);
-      SDL_RenderClear(renderer);
-      UI_Render();
-      SDL_RenderPresent(renderer);
-    }
+typedef enum {
+  UI_TWEEN_COLOR,
+  UI_TWEEN_POS,
+  UI_TWEEN_SIZE,
+  UI_TWEEN_OPACITY,
+} UI_TweenProperty;
 
-    // Throttle FPS.
-    SDL_Delay(1000/16);
-  }
+typedef struct {
+  f32 v[UI_TWEEN_CHANNELS];
+} UI_TweenValue;
+
+// Stored as a structure of arrays, so all of them are advanced in one pass
+// over tightly packed lanes. Finished tweens keep their slot and hold their
+// target, so a widget can animate again from where it is, until they go
+// unused for UI_TWEEN_RETIRE_FRAMES.
+typedef struct {
+  i32 length;
+  i32 capacity;
+  // The storage id holding each tween's slot.
+  u32 *key;
+  // The last frame each tween was read on.
+  u32 *used;
+  u8 *easing;
+  // In SDL_GetTicks() time.
+  u32 *start;
+  u32 *duration;
+  UI_TweenValue *from;
+  UI_TweenValue *to;
+  UI_TweenValue *value;
+  // The tweens running this frame, and when the last of them ends.
+  i32 running;
+  u32 until;
+  // UI_Tween() calls on running tweens this frame, see UI_BeginMemo().
+  i32 touched;
+} UI_Tweens;
+
+// UI Deferred Subtrees
+
+typedef struct {
+  u32 id;
+  i32 priority;
+} UI_DeferredEntry;
+
+// UI Dynamic Resolution
+
+#define UI_RESOLUTION_SAMPLES 16
+
+// The scales rendered at as load rises, the first is native.
+const f32 ui_resolution_scales[] = {1.0f, 0.75f, 0.5f};
+
+// When rendering can't keep up, the frame is rendered into an offscreen
+// target at a reduced scale and upscaled to the window, until load drops.
+typedef struct {
+  // In ms, 0 when disabled.
+  f32 deadline;
+  // Redraw the hovered and pressed buttons at native resolution.
+  bool native_hover;
+  // Index into ui_resolution_scales.
+  i32 level;
+  // Render and present times in ms, since the level last changed.
+  f32 samples[UI_RESOLUTION_SAMPLES];
+  i32 samples_length;
+  u64 render_start;
+  SDL_Texture *target;
+  i32 w, h;
+  // True while rendering into target.
+  bool scaled;
+} UI_DynamicResolution;
+
+// UI Context
+
+// The most each growable buffer has held in a frame.
+typedef struct {
+  i32 draw_cmds;
+  i32 states;
+  i32 aligns;
+} UI_HighWater;
+
+// Capacities of a context, fixed when it's created. The draw queue, the memo
+// cache and the state and align stacks start at theirs, and grow as needed.
+typedef struct {
+  i32 max_draw_cmd;
+  // The states are allocated in chunks of this many.
+  i32 max_state;
+  i32 max_align;
+  i32 max_storage;
+  i32 max_memo;
+  i32 max_memo_cmd;
+  i32 max_input_event;
+  i32 max_render_cache;
+  i32 max_node;
+  i32 max_image;
+  // Textures are evicted above this, least recently rendered first.
+  i64 max_image_bytes;
+  // Each frame's arena starts at this, and grows to fit.
+  i32 frame_arena_size;
+} UI_ContextDesc;
+
+const UI_ContextDesc ui_default_context_desc = {
+  .max_draw_cmd = UI_MAX_DRAW_CMD,
+  .max_state = UI_MAX_STATE,
+  .max_align = UI_MAX_ALIGN,
+  .max_storage = UI_MAX_STORAGE,
+  .max_memo = UI_MAX_MEMO,
+  .max_memo_cmd = UI_MAX_MEMO_CMD,
+  .max_input_event = UI_MAX_INPUT_EVENT,
+  .max_render_cache = UI_MAX_RENDER_CACHE,
+  .max_node = UI_MAX_NODE,
+  .max_image = UI_MAX_IMAGE,
+  .max_image_bytes = UI_MAX_IMAGE_BYTES,
+  .frame_arena_size = UI_FRAME_ARENA_SIZE,
+};
+
+// Nodes hold a panel each, and are rendered through their parent, sharing
+// its image cache.
+const UI_ContextDesc ui_node_context_desc = {
+  .max_draw_cmd = UI_MAX_DRAW_CMD,
+  .max_state = UI_MAX_STATE,
+  .max_align = UI_MAX_ALIGN,
+  .max_storage = UI_MAX_STORAGE / 8,
+  .max_memo = UI_MAX_MEMO,
+  .max_memo_cmd = UI_MAX_DRAW_CMD,
+  .max_input_event = UI_MAX_INPUT_EVENT,
+  .max_render_cache = 1,
+  .max_node = 0,
+  .max_image = 0,
+  .frame_arena_size = UI_FRAME_ARENA_SIZE / 8,
+};
+
+// All the state of one UI. Contexts are independent, so several UIs can be
+// built at once, each on its own thread.
+struct UI_Context {
+  UI_ContextDesc desc;
+
+  UI_StorageEntry *storage;
+
+  // Frames pass through three slots: the one being built, the newest built
+  // one, and the one being rendered. Neither side ever waits on the other, a
+  // built frame the renderer hasn't taken yet is replaced by a newer one.
+  UI_Frame frames[3];
+  UI_Frame *build;
+  // The last frame built, its hit index resolves the input of the next one.
+  UI_Frame *built;
+  UI_Frame *render;
+  // The index of the slot in between, with UI_SLOT_FRESH set when it holds
+  // a frame newer than render.
+  SDL_atomic_t mailbox;
+  // Incremented by UI_Clear(), the first frame is 1.
+  u32 frame;
+  // The number of cmds culled at emission this frame.
+  i32 emit_culled;
+
+  // Double buffered, memoized ranges are read from last frame's buffer and
+  // recorded into the current frame's buffer.
+  UI_DrawCmd *memo_cache[2];
+  i32 memo_cache_length[2];
+  i32 memo_cache_capacity[2];
+  u32 *memo_stack;
+  i32 memo_stack_length;
+
+  // Resolved once per frame from the hit index, widgets only compare ids.
+  u32 hover_id;
+  u32 active_id;
+  // The innermost scroll region under the mouse last frame, receives the wheel.
+  u32 scroll_hover_id;
+  u32 scroll_hover_next;
+
+  UI_InputState input_state;
+  // Button events are queued as they're polled, and resolved in order at the
+  // start of the next frame. A press and release within one frame is still a
+  // click, and several clicks within one frame are all reported.
+  UI_InputEvent *input_events;
+  // Events [frame, head) were resolved this frame, [head, tail) are pending.
+  u32 input_events_frame;
+  u32 input_events_head;
+  u32 input_events_tail;
+  // Events dropped because the ring was full.
+  u32 input_events_dropped;
+  // The ids clicked this frame, consumed by the widgets.
+  u32 *clicks;
+  i32 clicks_length;
+
+  // Time from each input event's SDL timestamp to every stage of the frame
+  // that handles it. Written by the renderer, under latency_lock.
+  UI_LatencyHistogram latency[UI_LATENCY_STAGE_COUNT];
+  SDL_SpinLock latency_lock;
+
+  // Chunks of desc.max_state states, added as the stack grows. ui points
+  // into them, so states never move.
+  UI_State **state_chunks;
+  i32 state_chunks_length;
+  i32 state_stack_length;
+  // The top of the state stack, used through ui.
+  UI_State *state;
+
+  const u8 **align_stack;
+  i32 align_stack_length;
+  i32 align_stack_capacity;
+
+  UI_HighWater high_water;
+
+  // SDL_GetTicks() as of UI_Clear(), the time tweens are evaluated at.
+  u32 time;
+  // Set by UI_Replay(), which sets time to the recorded frame's instead.
+  bool replaying;
+  UI_Tweens tweens;
+  // When the last tween running in the last frame built ends, or 0. Read by
+  // the main loop, which keeps running frames until then.
+  SDL_atomic_t animation_deadline;
+
+  // The time in ms deferred subtrees may take to build per frame, 0 to build
+  // all of them every frame. See UI_BeginDeferred() and UI_SetBuildBudget().
+  f32 build_budget;
+  // The deferred subtrees seen this frame, planned by the next UI_Clear().
+  UI_DeferredEntry *deferred;
+  i32 deferred_length;
+  i32 deferred_capacity;
+  // The deferred subtrees replayed this frame.
+  i32 deferred_replayed;
+
+  UI_CullStats cull_stats;
+  // Scratch for the cull, occlusion and hit index passes, sized for the
+  // draw queue.
+  u8 *in_window;
+  bool *keep;
+  Rect *clips;
+  i32 scratch_capacity;
+
+  // Written by the renderer.
+  UI_LatchStats latch_stats;
+  // When the pointer was sampled for the next frame.
+  u64 sample_time;
+
+  // NULL for a headless context, which can be built but not rendered.
+  SDL_Renderer *renderer;
+  UI_RenderCacheEntry *render_cache;
+  UI_DynamicResolution resolution;
+
+  // See UI_BeginRecording().
+  SDL_RWops *recording;
+
+  // Registered from any thread, slots may be NULL while being filled in.
+  UI_OverlayBuffer *overlays[UI_MAX_OVERLAY_BUFFER];
+  SDL_atomic_t overlays_length;
+  // Scratch for merging every buffer's batch.
+  UI_OverlayCmd *overlay_cmds;
+  i32 overlay_cmds_capacity;
+
+  UI_NodeContext *nodes;
+  i32 nodes_length;
+  // The nodes built by UI_BuildNodes(), in tree order.
+  UI_NodeBuild *node_builds;
+
+  // Shared with the parent by node contexts.
+  UI_ImageCache *images;
+};
+
+// The context the UI functions operate on, set per thread.
+_Thread_local UI_Context *ui_ctx = NULL;
+
+// The current layout state.
+#define ui (ui_ctx->state)
+
+void UI_DestroyContext(UI_Context *ctx);
+
+// Returns false if out of memory, the frame is freed by UI_FreeFrame() either
+// way.
+bool UI_InitFrame(UI_Frame *frame, const UI_ContextDesc *d) {
+  UI_DrawQueue *queue = &frame->draw_queue;
+  queue->capacity = d->max_draw_cmd;
+  queue->id = UI_Calloc(d->max_draw_cmd, sizeof(*queue->id));
+  queue->type = UI_Calloc(d->max_draw_cmd, sizeof(*queue->type));
+  queue->x = UI_Calloc(d->max_draw_cmd, sizeof(*queue->x));
+  queue->y = UI_Calloc(d->max_draw_cmd, sizeof(*queue->y));
+  queue->w = UI_Calloc(d->max_draw_cmd, sizeof(*queue->w));
+  queue->h = UI_Calloc(d->max_draw_cmd, sizeof(*queue->h));
+  queue->payload = UI_Calloc(d->max_draw_cmd, sizeof(*queue->payload));
+  queue->payloads = UI_Calloc(d->max_draw_cmd, sizeof(*queue->payloads));
+
+  UI_HitIndex *index = &frame->hit_index;
+  index->capacity = d->max_draw_cmd;
+  index->id = UI_Calloc(d->max_draw_cmd, sizeof(*index->id));
+  index->rect = UI_Calloc(d->max_draw_cmd, sizeof(*index->rect));
+  index->entries = UI_Calloc(d->max_draw_cmd * UI_HIT_ENTRIES_PER_RECT, sizeof(*index->entries));
+  index->entries_capacity = d->max_draw_cmd * UI_HIT_ENTRIES_PER_RECT;
+
+  frame->event_times = UI_Calloc(d->max_input_event, sizeof(*frame->event_times));
+  frame->arena.base = UI_Malloc(d->frame_arena_size);
+  frame->arena.capacity = d->frame_arena_size;
+
+  return queue->id && queue->type && queue->x && queue->y && queue->w && queue->h &&
+         queue->payload && queue->payloads && index->id && index->rect && index->entries &&
+         frame->event_times && frame->arena.base;
+}
+
+// Frees the overflow, growing the block to fit it.
+void UI_ResetArena(UI_Arena *arena) {
+  size_t used = arena->used + arena->overflow_bytes;
+  arena->high_water = SDL_max(arena->high_water, used);
+  while (arena->overflow != NULL) {
+    UI_ArenaOverflow *next = arena->overflow->next;
+    SDL_free(arena->overflow);
+    arena->overflow = next;
+  }
+  if (arena->overflow_bytes > 0) {
+    size_t capacity = SDL_max(arena->capacity * 2, used);
+    u8 *base = UI_Malloc(capacity);
+    // Out of memory, the overflow is allocated again.
+    if (base != NULL) {
+      SDL_free(arena->base);
+      arena->base = base;
+      arena->capacity = capacity;
+    }
+  }
+  arena->used = 0;
+  arena->overflow_bytes = 0;
+}
+
+// Returns NULL if out of memory.
+void *UI_ArenaAlloc(UI_Arena *arena, size_t size) {
+  size = (size + UI_ARENA_ALIGN - 1) & ~(size_t)(UI_ARENA_ALIGN - 1);
+  if (arena->capacity - arena->used >= size) {
+    void *data = arena->base + arena->used;
+    arena->used += size;
+    return data;
+  }
+  UI_ArenaOverflow *overflow = UI_Malloc(UI_ARENA_ALIGN + size);
+  if (overflow == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  overflow->next = arena->overflow;
+  arena->overflow = overflow;
+  arena->overflow_bytes += size;
+  return (u8 *)overflow + UI_ARENA_ALIGN;
+}
+
+void UI_FreeFrame(UI_Frame *frame) {
+  UI_DrawQueue *queue = &frame->draw_queue;
+  SDL_free(queue->id);
+  SDL_free(queue->type);
+  SDL_free(queue->x);
+  SDL_free(queue->y);
+  SDL_free(queue->w);
+  SDL_free(queue->h);
+  SDL_free(queue->payload);
+  SDL_free(queue->payloads);
+  SDL_free(frame->hit_index.id);
+  SDL_free(frame->hit_index.rect);
+  SDL_free(frame->hit_index.entries);
+  SDL_free(frame->event_times);
+  UI_ResetArena(&frame->arena);
+  SDL_free(frame->arena.base);
+}
+
+// Returns NULL if out of memory. desc may be NULL for the default capacities,
+// and renderer NULL for a headless context.
+UI_Context *UI_CreateContext(const UI_ContextDesc *desc, SDL_Renderer *renderer) {
+  UI_Context *ctx = UI_Calloc(1, sizeof(UI_Context));
+  if (ctx == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  ctx->desc = desc ? *desc : ui_default_context_desc;
+  ctx->renderer = renderer;
+
+  UI_ContextDesc *d = &ctx->desc;
+  bool frames = true;
+  for (i32 i = 0; i < 3; i++) {
+    frames &= UI_InitFrame(&ctx->frames[i], d);
+  }
+  ctx->build = &ctx->frames[0];
+  ctx->built = &ctx->frames[1];
+  ctx->render = &ctx->frames[2];
+  SDL_AtomicSet(&ctx->mailbox, 1);
+
+  ctx->storage = UI_Calloc(d->max_storage, sizeof(*ctx->storage));
+  ctx->memo_cache[0] = UI_Calloc(d->max_memo_cmd, sizeof(*ctx->memo_cache[0]));
+  ctx->memo_cache[1] = UI_Calloc(d->max_memo_cmd, sizeof(*ctx->memo_cache[1]));
+  ctx->memo_cache_capacity[0] = d->max_memo_cmd;
+  ctx->memo_cache_capacity[1] = d->max_memo_cmd;
+  ctx->memo_stack = UI_Calloc(d->max_memo, sizeof(*ctx->memo_stack));
+  ctx->input_state = ui_default_input_state;
+  ctx->input_events = UI_Calloc(d->max_input_event, sizeof(*ctx->input_events));
+  ctx->clicks = UI_Calloc(d->max_input_event, sizeof(*ctx->clicks));
+  ctx->state_chunks = UI_Calloc(1, sizeof(*ctx->state_chunks));
+  if (ctx->state_chunks != NULL) {
+    ctx->state_chunks[0] = UI_Calloc(d->max_state, sizeof(UI_State));
+    ctx->state_chunks_length = 1;
+  }
+  ctx->align_stack = UI_Calloc(d->max_align, sizeof(*ctx->align_stack));
+  ctx->align_stack_capacity = d->max_align;
+  ctx->in_window = UI_Calloc(d->max_draw_cmd, sizeof(*ctx->in_window));
+  ctx->keep = UI_Calloc(d->max_draw_cmd, sizeof(*ctx->keep));
+  // One more than the draw queue, for the window's clip rect.
+  ctx->clips = UI_Calloc(d->max_draw_cmd + 1, sizeof(*ctx->clips));
+  ctx->scratch_capacity = d->max_draw_cmd;
+  ctx->render_cache = UI_Calloc(d->max_render_cache, sizeof(*ctx->render_cache));
+  ctx->overlay_cmds = UI_Calloc(UI_MAX_OVERLAY_BUFFER * UI_MAX_OVERLAY_CMD, sizeof(*ctx->overlay_cmds));
+  ctx->overlay_cmds_capacity = UI_MAX_OVERLAY_BUFFER * UI_MAX_OVERLAY_CMD;
+  ctx->nodes = UI_Calloc(d->max_node + 1, sizeof(*ctx->nodes));
+  ctx->node_builds = UI_Calloc(d->max_node + 1, sizeof(*ctx->node_builds));
+  bool images = true;
+  if (d->max_image > 0) {
+    ctx->images = UI_Calloc(1, sizeof(UI_ImageCache));
+    images = ctx->images && (ctx->images->entries = UI_Calloc(d->max_image, sizeof(UI_ImageEntry)));
+    if (images) {
+      ctx->images->capacity = d->max_image;
+      ctx->images->full.cache = ctx->images;
+      ctx->images->full.page = -1;
+      SDL_AtomicSet(&ctx->images->full.state, UI_IMAGE_FAILED);
+    }
+  }
+
+  if (!frames || !ctx->storage || !ctx->memo_cache[0] || !ctx->memo_cache[1] || !ctx->memo_stack ||
+      !ctx->input_events || !ctx->clicks || !ctx->state_chunks || !ctx->state_chunks[0] || !ctx->align_stack ||
+      !ctx->in_window || !ctx->keep || !ctx->clips || !ctx->render_cache || !ctx->overlay_cmds ||
+      !ctx->nodes || !ctx->node_builds || !images) {
+    SDL_OutOfMemory();
+    UI_DestroyContext(ctx);
+    return NULL;
+  }
+
+  ctx->state_chunks[0][0] = ui_default_state;
+  ctx->state = ctx->state_chunks[0];
+  return ctx;
+}
+
+void UI_ReleaseRenderCache(UI_RenderCacheEntry *entry);
+void UI_ReleaseResolution(UI_DynamicResolution *resolution);
+void UI_DestroyOverlayBuffer(UI_OverlayBuffer *buffer);
+
+void UI_DestroyContext(UI_Context *ctx) {
+  if (ctx == NULL) {
+    return;
+  }
+  if (ctx->render_cache) {
+    for (i32 i = 0; i < ctx->desc.max_render_cache; i++) {
+      UI_ReleaseRenderCache(&ctx->render_cache[i]);
+      for (i32 j = 0; j < 2; j++) {
+        SDL_free(ctx->render_cache[i].lists[j].cmds);
+      }
+    }
+  }
+  UI_ReleaseResolution(&ctx->resolution);
+  if (ctx->recording) {
+    SDL_RWclose(ctx->recording);
+  }
+
+  for (i32 i = 0; i < 3; i++) {
+    UI_FreeFrame(&ctx->frames[i]);
+  }
+  SDL_free(ctx->storage);
+  SDL_free(ctx->memo_cache[0]);
+  SDL_free(ctx->memo_cache[1]);
+  SDL_free(ctx->memo_stack);
+  SDL_free(ctx->input_events);
+  SDL_free(ctx->clicks);
+  for (i32 i = 0; i < ctx->state_chunks_length; i++) {
+    SDL_free(ctx->state_chunks[i]);
+  }
+  SDL_free(ctx->state_chunks);
+  SDL_free(ctx->align_stack);
+  SDL_free(ctx->tweens.key);
+  SDL_free(ctx->tweens.used);
+  SDL_free(ctx->tweens.easing);
+  SDL_free(ctx->tweens.start);
+  SDL_free(ctx->tweens.duration);
+  SDL_free(ctx->tweens.from);
+  SDL_free(ctx->tweens.to);
+  SDL_free(ctx->tweens.value);
+  SDL_free(ctx->deferred);
+  SDL_free(ctx->in_window);
+  SDL_free(ctx->keep);
+  SDL_free(ctx->clips);
+  SDL_free(ctx->render_cache);
+  for (i32 i = 0; i < UI_MAX_OVERLAY_BUFFER; i++) {
+    UI_DestroyOverlayBuffer(ctx->overlays[i]);
+  }
+  SDL_free(ctx->overlay_cmds);
+  for (i32 i = 0; i < ctx->nodes_length; i++) {
+    UI_DestroyContext(ctx->nodes[i].ctx);
+  }
+  SDL_free(ctx->nodes);
+  SDL_free(ctx->node_builds);
+
+  // Decodes must be finished, the textures released by UI_ReleaseRenderer().
+  if (ctx->desc.max_image > 0 && ctx->images) {
+    if (ctx->images->entries) {
+      for (i32 i = 0; i < ctx->images->capacity; i++) {
+        SDL_free(ctx->images->entries[i].path);
+        SDL_FreeSurface(ctx->images->entries[i].surface);
+      }
+    }
+    SDL_free(ctx->images->entries);
+    for (i32 i = 0; i < SDL_AtomicGet(&ctx->images->tile_sets_length); i++) {
+      UI_TileSet *set = &ctx->images->tile_sets[i];
+      for (i32 j = 0; j < set->source->level_tiles[set->source->levels]; j++) {
+        SDL_FreeSurface(set->tiles[j].surface);
+      }
+      SDL_free(set->tiles);
+    }
+    for (i32 i = 0; i < UI_MAX_STREAM; i++) {
+      if (ctx->images->streams[i] != NULL) {
+        SDL_free(ctx->images->streams[i]->pixels);
+        SDL_free(ctx->images->streams[i]);
+      }
+    }
+    SDL_free(ctx->images);
+  }
+  SDL_free(ctx);
+}
+
+// Makes ctx current on the calling thread.
+void UI_SetContext(UI_Context *ctx) {
+  ui_ctx = ctx;
+}
+
+// UI Storage
+
+UI_Data *ui_get_data(u32 id) {
+  for (i32 i = 0; i < ui_ctx->desc.max_storage; i++) {
+    u32 index = (id + i) % ui_ctx->desc.max_storage;
+    if (ui_ctx->storage[index].id == 0 || ui_ctx->storage[index].id == id) {
+      ui_ctx->storage[index].id = id;
+      return &ui_ctx->storage[index].data;
+    }
+    printf("Storage cache miss [%u]: 0x%x\n", index, id);
+  }
+
+  assert(false);
+}
+
+// Frees the storage of id, if it has any. Invalidates pointers returned by
+// ui_get_data(), call between widgets.
+void ui_free_data(u32 id) {
+  u32 n = ui_ctx->desc.max_storage;
+  u32 i = 0;
+  while (i < n && ui_ctx->storage[(id + i) % n].id != id) {
+    if (ui_ctx->storage[(id + i) % n].id == 0) {
+      return;
+    }
+    i++;
+  }
+  if (i == n) {
+    return;
+  }
+
+  // Shift back the entries after it that probed past it, so every lookup
+  // still finds its entry before the first empty one.
+  u32 hole = (id + i) % n;
+  for (u32 j = (hole + 1) % n; ui_ctx->storage[j].id != 0; j = (j + 1) % n) {
+    u32 home = ui_ctx->storage[j].id % n;
+    if ((j + n - home) % n >= (j + n - hole) % n) {
+      ui_ctx->storage[hole] = ui_ctx->storage[j];
+      hole = j;
+    }
+  }
+  ui_ctx->storage[hole] = (UI_StorageEntry){0};
+}
+
+// UI Draw Queue
+
+void UI_SetDrawCmdRect(i32 index, Rect rect) {
+  UI_DrawQueue *queue = &ui_ctx->build->draw_queue;
+  i32 x0 = SDL_clamp(rect.x, UI_COORD_MIN, UI_COORD_MAX);
+  i32 y0 = SDL_clamp(rect.y, UI_COORD_MIN, UI_COORD_MAX);
+  i32 x1 = SDL_clamp(rect.x + rect.w, UI_COORD_MIN, UI_COORD_MAX);
+  i32 y1 = SDL_clamp(rect.y + rect.h, UI_COORD_MIN, UI_COORD_MAX);
+  queue->x[index] = x0;
+  queue->y[index] = y0;
+  queue->w[index] = x1 - x0;
+  queue->h[index] = y1 - y0;
+}
+
+Rect UI_GetDrawCmdRect(UI_DrawQueue *queue, i32 index) {
+  return (Rect){queue->x[index], queue->y[index], queue->w[index], queue->h[index]};
+}
+
+// Returns false if out of memory, lane is unchanged then.
+bool UI_ResizeLane(void **lane, i32 capacity, size_t size) {
+  void *resized = UI_Realloc(*lane, capacity * size);
+  if (resized == NULL) {
+    return false;
+  }
+  *lane = resized;
+  return true;
+}
+
+// Grows array to hold length elements, doubling its capacity. Returns false
+// if out of memory.
+bool UI_GrowArray(void **array, i32 *capacity, i32 length, size_t size) {
+  if (length <= *capacity) {
+    return true;
+  }
+  i32 grown = SDL_max(*capacity * 2, length);
+  if (!UI_ResizeLane(array, grown, size)) {
+    SDL_OutOfMemory();
+    return false;
+  }
+  *capacity = grown;
+  return true;
+}
+
+// Grows the lanes to hold length cmds and their payloads. The capacity is
+// kept across frames, so once the largest frame fits nothing is allocated.
+// Cmds are only referred to by index, so they're free to move. Returns false
+// if out of memory.
+bool UI_ReserveDrawQueue(UI_DrawQueue *queue, i32 length) {
+  if (length <= queue->capacity) {
+    return true;
+  }
+  i32 capacity = SDL_max(queue->capacity * 2, length);
+  if (!UI_ResizeLane((void **)&queue->id, capacity, sizeof(*queue->id)) ||
+      !UI_ResizeLane((void **)&queue->type, capacity, sizeof(*queue->type)) ||
+      !UI_ResizeLane((void **)&queue->x, capacity, sizeof(*queue->x)) ||
+      !UI_ResizeLane((void **)&queue->y, capacity, sizeof(*queue->y)) ||
+      !UI_ResizeLane((void **)&queue->w, capacity, sizeof(*queue->w)) ||
+      !UI_ResizeLane((void **)&queue->h, capacity, sizeof(*queue->h)) ||
+      !UI_ResizeLane((void **)&queue->payload, capacity, sizeof(*queue->payload)) ||
+      !UI_ResizeLane((void **)&queue->payloads, capacity, sizeof(*queue->payloads))) {
+    SDL_OutOfMemory();
+    return false;
+  }
+  queue->capacity = capacity;
+  return true;
+}
+
+// Returns the index of the new cmd.
+i32 UI_PushDrawCmd(UI_DrawCmdType type, u32 id, Rect rect) {
+  UI_DrawQueue *queue = &ui_ctx->build->draw_queue;
+  if (queue->length == queue->capacity && !UI_ReserveDrawQueue(queue, queue->length + 1)) {
+    // Out of memory.
+    assert(false);
+  }
+
+  i32 index = queue->length++;
+  queue->id[index] = id;
+  queue->type[index] = type;
+  queue->payload[index] = -1;
+  UI_SetDrawCmdRect(index, rect);
+  return index;
+}
+
+void UI_SetDrawCmdPayload(i32 index, UI_DrawPayload payload) {
+  UI_DrawQueue *queue = &ui_ctx->build->draw_queue;
+  assert(queue->payloads_length < queue->capacity);
+
+  queue->payload[index] = queue->payloads_length;
+  queue->payloads[queue->payloads_length++] = payload;
+}
+
+UI_DrawCmd UI_GetDrawCmd(UI_DrawQueue *queue, i32 index) {
+  UI_DrawCmd cmd = {
+    .id = queue->id[index],
+    .type = queue->type[index],
+    .rect = UI_GetDrawCmdRect(queue, index),
+  };
+  if (queue->payload[index] >= 0) {
+    cmd.payload = queue->payloads[queue->payload[index]];
+  }
+  return cmd;
+}
+
+i32 UI_AppendDrawCmd(UI_DrawCmd *cmd) {
+  i32 index = UI_PushDrawCmd(cmd->type, cmd->id, cmd->rect);
+  if (UI_DrawCmdHasPayload(cmd->type)) {
+    UI_SetDrawCmdPayload(index, cmd->payload);
+  }
+  return index;
+}
+
+// Used to compact the queue, the payload is shared.
+void UI_MoveDrawCmd(i32 dst, i32 src) {
+  UI_DrawQueue *queue = &ui_ctx->build->draw_queue;
+  queue->id[dst] = queue->id[src];
+  queue->type[dst] = queue->type[src];
+  queue->x[dst] = queue->x[src];
+  queue->y[dst] = queue->y[src];
+  queue->w[dst] = queue->w[src];
+  queue->h[dst] = queue->h[src];
+  queue->payload[dst] = queue->payload[src];
+}
+
+// Returns the index of the UI_UNCLIP matching the UI_CLIP at index.
+i32 UI_FindUnclip(UI_DrawQueue *queue, i32 index) {
+  i32 depth = 0;
+  for (i32 i = index; i < queue->length; i++) {
+    if (queue->type[i] == UI_CLIP) {
+      depth++;
+    } else if (queue->type[i] == UI_UNCLIP && --depth == 0) {
+      return i;
+    }
+  }
+
+  assert(false);
+}
+
+// Returns the index of the UI_CLIP matching the UI_UNCLIP at index.
+i32 UI_FindClip(UI_DrawQueue *queue, i32 index) {
+  i32 depth = 0;
+  for (i32 i = index; i >= 0; i--) {
+    if (queue->type[i] == UI_UNCLIP) {
+      depth++;
+    } else if (queue->type[i] == UI_CLIP && --depth == 0) {
+      return i;
+    }
+  }
+
+  assert(false);
+}
+
+// UI Hit Index
+
+// Grows the scratch of the passes over the draw queue to fit it. Scroll
+// regions nest at most as deep as there are cmds, so that bounds the clip
+// stacks too.
+void UI_ReserveScratch(i32 length) {
+  if (length <= ui_ctx->scratch_capacity) {
+    return;
+  }
+  i32 capacity = SDL_max(ui_ctx->scratch_capacity * 2, length);
+  if (!UI_ResizeLane((void **)&ui_ctx->in_window, capacity, sizeof(*ui_ctx->in_window)) ||
+      !UI_ResizeLane((void **)&ui_ctx->keep, capacity, sizeof(*ui_ctx->keep)) ||
+      !UI_ResizeLane((void **)&ui_ctx->clips, capacity + 1, sizeof(*ui_ctx->clips))) {
+    // Out of memory.
+    assert(false);
+  }
+  ui_ctx->scratch_capacity = capacity;
+}
+
+// Grows the index to fit every cmd of the draw queue.
+void UI_ReserveHitIndex(UI_HitIndex *index, i32 length) {
+  if (length <= index->capacity) {
+    return;
+  }
+  i32 capacity = SDL_max(index->capacity * 2, length);
+  if (!UI_ResizeLane((void **)&index->id, capacity, sizeof(*index->id)) ||
+      !UI_ResizeLane((void **)&index->rect, capacity, sizeof(*index->rect))) {
+    // Out of memory.
+    assert(false);
+  }
+  index->capacity = capacity;
+}
+
+// Grows the cells' entries, large blockers can span many cells.
+void UI_ReserveHitEntries(UI_HitIndex *index, i32 length) {
+  if (length <= index->entries_capacity) {
+    return;
+  }
+  i32 capacity = SDL_max(index->entries_capacity * 2, length);
+  if (!UI_ResizeLane((void **)&index->entries, capacity, sizeof(*index->entries))) {
+    // Out of memory.
+    assert(false);
+  }
+  index->entries_capacity = capacity;
+}
+
+// Rebuilds the hit index from the draw queue. Runs after culling, so that
+// the rects match what is drawn, including any moved by UI_EndAlign().
+void UI_BuildHitIndex() {
+  UI_HitIndex *index = &ui_ctx->build->hit_index;
+  UI_DrawQueue *queue = &ui_ctx->build->draw_queue;
+  UI_ReserveHitIndex(index, queue->length);
+  UI_ReserveScratch(queue->length);
+
+  Rect *clips = ui_ctx->clips;
+  i32 clips_length = 0;
+  clips[clips_length++] = (Rect){0, 0, WINDOW_WIDTH, WINDOW_HEIGHT};
+
+  index->length = 0;
+  for (i32 i = 0; i < queue->length; i++) {
+    Rect rect = UI_GetDrawCmdRect(queue, i);
+    switch (queue->type[i]) {
+      case UI_CLIP: {
+        Rect next;
+        if (!SDL_IntersectRect(&rect, &clips[clips_length - 1], &next)) {
+          next = (Rect){rect.x, rect.y, 0, 0};
+        }
+        clips[clips_length++] = next;
+      } break;
+      case UI_UNCLIP:
+        clips_length--;
+        break;
+      case UI_BUTTON:
+        if (SDL_IntersectRect(&rect, &clips[clips_length - 1], &index->rect[index->length])) {
+          index->id[index->length++] = queue->id[i];
+        }
+        break;
+      case UI_FILL:
+        if (queue->payloads[queue->payload[i]].color.a != 255) {
+          break;
+        }
+        // Fallthrough.
+      case UI_RECT:
+      case UI_PANEL:
+        // Opaque, so it blocks the buttons under it. Only those drawn before
+        // it are under it.
+        if (index->length > 0 && SDL_IntersectRect(&rect, &clips[clips_length - 1], &index->rect[index->length])) {
+          index->id[index->length++] = 0;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  // Bucket the rects into cells with a counting sort, which keeps them in
+  // emission order within each cell.
+  i32 *cells = index->cells;
+  memset(cells, 0, sizeof(index->cells));
+  for (i32 i = 0; i < index->length; i++) {
+    Rect *rect = &index->rect[i];
+    for (i32 row = rect->y / UI_HIT_CELL; row <= (rect->y + rect->h - 1) / UI_HIT_CELL; row++) {
+      for (i32 column = rect->x / UI_HIT_CELL; column <= (rect->x + rect->w - 1) / UI_HIT_CELL; column++) {
+        cells[row * UI_HIT_COLUMNS + column + 1]++;
+      }
+    }
+  }
+  for (i32 c = 0; c < UI_HIT_CELLS; c++) {
+    cells[c + 1] += cells[c];
+  }
+  UI_ReserveHitEntries(index, cells[UI_HIT_CELLS]);
+
+  i32 next[UI_HIT_CELLS];
+  memcpy(next, cells, sizeof(next));
+  for (i32 i = 0; i < index->length; i++) {
+    Rect *rect = &index->rect[i];
+    for (i32 row = rect->y / UI_HIT_CELL; row <= (rect->y + rect->h - 1) / UI_HIT_CELL; row++) {
+      for (i32 column = rect->x / UI_HIT_CELL; column <= (rect->x + rect->w - 1) / UI_HIT_CELL; column++) {
+        index->entries[next[row * UI_HIT_COLUMNS + column]++] = i;
+      }
+    }
+  }
+}
+
+// Returns the id of the topmost interactive rect containing point, or 0 if
+// there's none, or an opaque cmd is drawn over it.
+u32 UI_HitTest(UI_HitIndex *index, v2 point) {
+  if (point.x < 0 || point.x >= WINDOW_WIDTH || point.y < 0 || point.y >= WINDOW_HEIGHT) {
+    return 0;
+  }
+
+  i32 cell = (point.y / UI_HIT_CELL) * UI_HIT_COLUMNS + point.x / UI_HIT_CELL;
+  for (i32 i = index->cells[cell + 1] - 1; i >= index->cells[cell]; i--) {
+    i32 entry = index->entries[i];
+    if (SDL_PointInRect(&point, &index->rect[entry])) {
+      return index->id[entry];
+    }
+  }
+  return 0;
+}
+
+// UI Input Events
+
+void UI_PushInputEvent(UI_InputEvent event) {
+  // The ring is drained every frame, so it only fills up under a flood, then
+  // the oldest pending event is dropped. The last frame's resolved events
+  // went with it.
+  if (ui_ctx->input_events_tail - ui_ctx->input_events_head >= (u32)ui_ctx->desc.max_input_event) {
+    ui_ctx->input_events_head++;
+    ui_ctx->input_events_frame = ui_ctx->input_events_head;
+    ui_ctx->input_events_dropped++;
+  }
+  ui_ctx->input_events[ui_ctx->input_events_tail++ % ui_ctx->desc.max_input_event] = event;
+}
+
+// Replays the pending events against last frame's hit index, tracking the
+// active id and recording a click for every release over the active id.
+void UI_ResolveInputEvents() {
+  ui_ctx->clicks_length = 0;
+  ui_ctx->input_events_frame = ui_ctx->input_events_head;
+  UI_Frame *frame = ui_ctx->build;
+  frame->event_times_length = 0;
+  for (; ui_ctx->input_events_head != ui_ctx->input_events_tail; ui_ctx->input_events_head++) {
+    UI_InputEvent *event = &ui_ctx->input_events[ui_ctx->input_events_head % ui_ctx->desc.max_input_event];
+    frame->event_times[frame->event_times_length++] = event->timestamp;
+    bool button = event->type == UI_INPUT_MOUSE_DOWN || event->type == UI_INPUT_MOUSE_UP;
+    if (!button || event->button != UI_MOUSE_BUTTON_LEFT) {
+      continue;
+    }
+    u32 id = UI_HitTest(&ui_ctx->built->hit_index, event->pos);
+    switch (event->type) {
+      case UI_INPUT_MOUSE_DOWN:
+        if (ui_ctx->active_id == 0) {
+          ui_ctx->active_id = id;
+        }
+        break;
+      case UI_INPUT_MOUSE_UP:
+        if (ui_ctx->active_id != 0 && ui_ctx->active_id == id) {
+          ui_ctx->clicks[ui_ctx->clicks_length++] = id;
+        }
+        ui_ctx->active_id = 0;
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// Returns true if any event of the given type this frame landed in rect.
+bool UI_InputEventInRect(UI_InputEventType type, Rect *rect) {
+  for (u32 i = ui_ctx->input_events_frame; i != ui_ctx->input_events_head; i++) {
+    UI_InputEvent *event = &ui_ctx->input_events[i % ui_ctx->desc.max_input_event];
+    if (event->type == type && SDL_PointInRect(&event->pos, rect)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// UI Latency
+
+void UI_MarkLatency(UI_Frame *frame, UI_LatencyStage stage) {
+  frame->latency_ticks[stage] = SDL_GetTicks();
+}
+
+// Adds the frame's events to the histograms, call once every stage is marked.
+void UI_RecordLatency(UI_Frame *frame) {
+  SDL_AtomicLock(&ui_ctx->latency_lock);
+  for (i32 i = 0; i < frame->event_times_length; i++) {
+    for (i32 stage = 0; stage < UI_LATENCY_STAGE_COUNT; stage++) {
+      u32 ms = frame->latency_ticks[stage] - frame->event_times[i];
+      ui_ctx->latency[stage].buckets[SDL_min(ms, UI_LATENCY_BUCKETS - 1)]++;
+      ui_ctx->latency[stage].count++;
+    }
+  }
+  SDL_AtomicUnlock(&ui_ctx->latency_lock);
+}
+
+// Copies the histograms, safe to call while the renderer records into them.
+void UI_GetLatency(UI_LatencyHistogram latency[UI_LATENCY_STAGE_COUNT]) {
+  SDL_AtomicLock(&ui_ctx->latency_lock);
+  memcpy(latency, ui_ctx->latency, sizeof(ui_ctx->latency));
+  SDL_AtomicUnlock(&ui_ctx->latency_lock);
+}
+
+// Returns the latency in ms that a fraction p of the events were within,
+// e.g. 0.99 for p99.
+u32 UI_LatencyPercentile(UI_LatencyHistogram *histogram, f32 p) {
+  u32 rank = SDL_max(1, (u32)(p * histogram->count + 0.5f));
+  u32 seen = 0;
+  for (u32 i = 0; i < UI_LATENCY_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= rank) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+// UI Tweens
+
+f32 UI_Ease(UI_Easing easing, f32 t) {
+  f32 u = 1 - t;
+  switch (easing) {
+    case UI_EASE_LINEAR:
+      return t;
+    case UI_EASE_IN:
+      return t * t * t;
+    case UI_EASE_OUT:
+      return 1 - u * u * u;
+    case UI_EASE_IN_OUT:
+      return t < 0.5f ? 4 * t * t * t : 1 - 4 * u * u * u;
+  }
+  return t;
+}
+
+bool UI_ReserveTweens(UI_Tweens *tweens, i32 length) {
+  if (length <= tweens->capacity) {
+    return true;
+  }
+  i32 capacity = SDL_max(tweens->capacity * 2, 64);
+  if (!UI_ResizeLane((void **)&tweens->key, capacity, sizeof(*tweens->key)) ||
+      !UI_ResizeLane((void **)&tweens->used, capacity, sizeof(*tweens->used)) ||
+      !UI_ResizeLane((void **)&tweens->easing, capacity, sizeof(*tweens->easing)) ||
+      !UI_ResizeLane((void **)&tweens->start, capacity, sizeof(*tweens->start)) ||
+      !UI_ResizeLane((void **)&tweens->duration, capacity, sizeof(*tweens->duration)) ||
+      !UI_ResizeLane((void **)&tweens->from, capacity, sizeof(*tweens->from)) ||
+      !UI_ResizeLane((void **)&tweens->to, capacity, sizeof(*tweens->to)) ||
+      !UI_ResizeLane((void **)&tweens->value, capacity, sizeof(*tweens->value))) {
+    SDL_OutOfMemory();
+    return false;
+  }
+  tweens->capacity = capacity;
+  return true;
+}
+
+// Moves the last tween into slot i.
+void UI_RemoveTween(UI_Tweens *tweens, i32 i) {
+  ui_free_data(tweens->key[i]);
+  i32 last = --tweens->length;
+  if (i == last) {
+    return;
+  }
+  tweens->key[i] = tweens->key[last];
+  tweens->used[i] = tweens->used[last];
+  tweens->easing[i] = tweens->easing[last];
+  tweens->start[i] = tweens->start[last];
+  tweens->duration[i] = tweens->duration[last];
+  tweens->from[i] = tweens->from[last];
+  tweens->to[i] = tweens->to[last];
+  tweens->value[i] = tweens->value[last];
+  ui_get_data(tweens->key[i])->tween.slot = i + 1;
+}
+
+// Advances every tween to ui_ctx->time, in one pass, and retires the
+// finished ones that went unused. Called at the start of the frame, by
+// UI_Clear().
+void UI_UpdateTweens() {
+  UI_Tweens *tweens = &ui_ctx->tweens;
+  u32 now = ui_ctx->time;
+  tweens->running = 0;
+  tweens->until = now;
+  tweens->touched = 0;
+  for (i32 i = 0; i < tweens->length; i++) {
+    u32 elapsed = now - tweens->start[i];
+    // Memoized widgets only read their tweens when rebuilt, so a tween isn't
+    // retired as soon as it's skipped.
+    while (i < tweens->length && elapsed >= tweens->duration[i] &&
+           ui_ctx->frame - tweens->used[i] > UI_TWEEN_RETIRE_FRAMES) {
+      UI_RemoveTween(tweens, i);
+      elapsed = now - tweens->start[i];
+    }
+    if (i == tweens->length) {
+      break;
+    }
+    f32 t = 1;
+    if (elapsed < tweens->duration[i]) {
+      t = UI_Ease(tweens->easing[i], (f32)elapsed / tweens->duration[i]);
+      u32 end = tweens->start[i] + tweens->duration[i];
+      if ((i32)(end - tweens->until) > 0) {
+        tweens->until = end;
+      }
+      tweens->running++;
+    }
+    for (i32 c = 0; c < UI_TWEEN_CHANNELS; c++) {
+      f32 from = tweens->from[i].v[c];
+      tweens->value[i].v[c] = from + (tweens->to[i].v[c] - from) * t;
+    }
+  }
+}
+
+// Returns the current value of the tween for a property of the widget id,
+// retargeting it to target first if that changed, in which case it eases
+// there from its current value over duration ms. A new tween starts out at
+// its target.
+UI_TweenValue UI_Tween(u32 id, UI_TweenProperty property, UI_TweenValue target, u32 duration, UI_Easing easing) {
+  UI_Tweens *tweens = &ui_ctx->tweens;
+  u32 key = ui_hash_combine(ui_hash(&id, sizeof(id)), &property, sizeof(property));
+  UI_Data *data = ui_get_data(key);
+  i32 i = data->tween.slot - 1;
+  if (i < 0) {
+    if (!UI_ReserveTweens(tweens, tweens->length + 1)) {
+      return target;
+    }
+    i = tweens->length++;
+    data->tween.slot = i + 1;
+    tweens->key[i] = key;
+    tweens->start[i] = ui_ctx->time;
+    tweens->duration[i] = 0;
+    tweens->easing[i] = easing;
+    tweens->from[i] = target;
+    tweens->to[i] = target;
+    tweens->value[i] = target;
+  }
+
+  tweens->used[i] = ui_ctx->frame;
+
+  if (memcmp(&tweens->to[i], &target, sizeof(target)) != 0) {
+    bool running = ui_ctx->time - tweens->start[i] < tweens->duration[i];
+    tweens->from[i] = tweens->value[i];
+    tweens->to[i] = target;
+    tweens->start[i] = ui_ctx->time;
+    tweens->duration[i] = duration;
+    tweens->easing[i] = easing;
+    if (duration == 0) {
+      tweens->value[i] = target;
+    } else {
+      tweens->running += !running;
+      u32 end = ui_ctx->time + duration;
+      if ((i32)(end - tweens->until) > 0) {
+        tweens->until = end;
+      }
+    }
+  }
+  if (ui_ctx->time - tweens->start[i] < tweens->duration[i]) {
+    tweens->touched++;
+  }
+  return tweens->value[i];
+}
+
+UI_Color UI_TweenColor(u32 id, UI_Color target, u32 duration, UI_Easing easing) {
+  UI_TweenValue value = UI_Tween(id, UI_TWEEN_COLOR, (UI_TweenValue){{target.r, target.g, target.b, target.a}}, duration, easing);
+  return (UI_Color){SDL_lroundf(value.v[0]), SDL_lroundf(value.v[1]), SDL_lroundf(value.v[2]), SDL_lroundf(value.v[3])};
+}
+
+v2 UI_TweenPos(u32 id, v2 target, u32 duration, UI_Easing easing) {
+  UI_TweenValue value = UI_Tween(id, UI_TWEEN_POS, (UI_TweenValue){{target.x, target.y}}, duration, easing);
+  return (v2){SDL_lroundf(value.v[0]), SDL_lroundf(value.v[1])};
+}
+
+v2 UI_TweenSize(u32 id, v2 target, u32 duration, UI_Easing easing) {
+  UI_TweenValue value = UI_Tween(id, UI_TWEEN_SIZE, (UI_TweenValue){{target.x, target.y}}, duration, easing);
+  return (v2){SDL_lroundf(value.v[0]), SDL_lroundf(value.v[1])};
+}
+
+// Opacity is in [0, 1].
+f32 UI_TweenOpacity(u32 id, f32 target, u32 duration, UI_Easing easing) {
+  return UI_Tween(id, UI_TWEEN_OPACITY, (UI_TweenValue){{target}}, duration, easing).v[0];
+}
+
+// UI State
+
+void UI_PlanDeferred();
+
+void UI_Clear() {
+  ui_ctx->frame++;
+  if (!ui_ctx->replaying) {
+    ui_ctx->time = SDL_GetTicks();
+  }
+  UI_UpdateTweens();
+  UI_PlanDeferred();
+  ui_ctx->build->draw_queue.length = 0;
+  ui_ctx->build->draw_queue.payloads_length = 0;
+  UI_ResetArena(&ui_ctx->build->arena);
+  ui_ctx->emit_culled = 0;
+  ui_ctx->hover_id = UI_HitTest(&ui_ctx->built->hit_index, ui_ctx->input_state.mouse_pos);
+  UI_ResolveInputEvents();
+  UI_MarkLatency(ui_ctx->build, UI_LATENCY_HANDLED);
+  ui_ctx->scroll_hover_id = ui_ctx->scroll_hover_next;
+  ui_ctx->scroll_hover_next = 0;
+  ui_ctx->memo_cache_length[ui_ctx->frame & 1] = 0;
+  ui_ctx->state_stack_length = 0;
+  ui = ui_ctx->state_chunks[0];
+  *ui = ui_default_state;
+}
+
+// Returns false if out of memory.
+bool UI_AddStateChunk() {
+  UI_State **chunks = UI_Realloc(ui_ctx->state_chunks, (ui_ctx->state_chunks_length + 1) * sizeof(*chunks));
+  if (chunks == NULL) {
+    return false;
+  }
+  ui_ctx->state_chunks = chunks;
+  chunks[ui_ctx->state_chunks_length] = UI_Malloc(ui_ctx->desc.max_state * sizeof(UI_State));
+  if (chunks[ui_ctx->state_chunks_length] == NULL) {
+    return false;
+  }
+  ui_ctx->state_chunks_length++;
+  return true;
+}
+
+void UI_PushState() {
+  i32 chunk_size = ui_ctx->desc.max_state;
+  i32 length = ++ui_ctx->state_stack_length;
+  UI_State *state = ui + 1;
+  if (length % chunk_size == 0) {
+    if (length / chunk_size == ui_ctx->state_chunks_length && !UI_AddStateChunk()) {
+      // Out of memory.
+      assert(false);
+    }
+    state = ui_ctx->state_chunks[length / chunk_size];
+  }
+  *state = *ui;
+  ui = state;
+  ui_ctx->high_water.states = SDL_max(ui_ctx->high_water.states, length + 1);
+}
+
+void UI_PopState() {
+  assert(ui_ctx->state_stack_length > 0);
+
+  i32 chunk_size = ui_ctx->desc.max_state;
+  i32 length = --ui_ctx->state_stack_length;
+  ui = &ui_ctx->state_chunks[length / chunk_size][length % chunk_size];
+}
+
+// UI Frames
+
+// Hands slot to the other side of a triple buffer, and returns the slot it
+// takes in exchange, with UI_SLOT_FRESH set if that one is newer than what
+// the caller had. Writes to the slot handed over happen before the swap, and
+// accesses to the slot taken after it.
+i32 UI_ExchangeSlot(SDL_atomic_t *mailbox, i32 slot) {
+  SDL_MemoryBarrierRelease();
+  i32 next = SDL_AtomicSet(mailbox, slot);
+  SDL_MemoryBarrierAcquire();
+  return next;
+}
+
+// Hands the built frame to the renderer, call once it's built and before the
+// next UI_Clear(). Lock free, the build never waits for the renderer.
+void UI_EndFrame() {
+  UI_Frame *frame = ui_ctx->build;
+  frame->hover_id = ui_ctx->hover_id;
+  frame->active_id = ui_ctx->active_id;
+  frame->frame = ui_ctx->frame;
+  frame->cull_stats = ui_ctx->cull_stats;
+  frame->emit_culled = ui_ctx->emit_culled;
+  frame->deferred = ui_ctx->deferred_replayed;
+  frame->sample_time = ui_ctx->sample_time;
+  SDL_AtomicSet(&ui_ctx->animation_deadline, ui_ctx->tweens.running > 0 ? ui_ctx->tweens.until : 0);
+  UI_MarkLatency(frame, UI_LATENCY_BUILT);
+
+  // A frame replaced before it was presented hands its events to this one,
+  // those are the frames under load. Unless the renderer takes it first, in
+  // which case it's presented after all.
+  i32 slot = (i32)(frame - ui_ctx->frames) | UI_SLOT_FRESH;
+  i32 length = frame->event_times_length;
+  i32 next;
+  do {
+    next = SDL_AtomicGet(&ui_ctx->mailbox);
+    frame->event_times_length = length;
+    if (next & UI_SLOT_FRESH) {
+      UI_Frame *replaced = &ui_ctx->frames[next & ~UI_SLOT_FRESH];
+      i32 count = SDL_min(replaced->event_times_length, ui_ctx->desc.max_input_event - length);
+      memcpy(frame->event_times + length, replaced->event_times, count * sizeof(*frame->event_times));
+      frame->event_times_length += count;
+    }
+    SDL_MemoryBarrierRelease();
+  } while (!SDL_AtomicCAS(&ui_ctx->mailbox, next, slot));
+  SDL_MemoryBarrierAcquire();
+  ui_ctx->built = frame;
+  ui_ctx->build = &ui_ctx->frames[next & ~UI_SLOT_FRESH];
+}
+
+// Takes the newest built frame for UI_Render(). Returns false if none was
+// built since the last call, the last one taken is kept.
+bool UI_AcquireFrame() {
+  if (!(SDL_AtomicGet(&ui_ctx->mailbox) & UI_SLOT_FRESH)) {
+    return false;
+  }
+  i32 next = UI_ExchangeSlot(&ui_ctx->mailbox, (i32)(ui_ctx->render - ui_ctx->frames));
+  ui_ctx->render = &ui_ctx->frames[next & ~UI_SLOT_FRESH];
+  return true;
+}
+
+// Returns size bytes from the frame being built, which last until the frame
+// is rendered, e.g. for formatted labels. Returns NULL if out of memory.
+void *UI_FrameAlloc(size_t size) {
+  return UI_ArenaAlloc(&ui_ctx->build->arena, size);
+}
+
+// Returns "" if out of memory.
+const char *UI_FrameFormatV(const char *format, va_list args) {
+  va_list measure;
+  va_copy(measure, args);
+  i32 length = vsnprintf(NULL, 0, format, measure);
+  va_end(measure);
+  char *text = length < 0 ? NULL : UI_FrameAlloc(length + 1);
+  if (text == NULL) {
+    return "";
+  }
+  vsnprintf(text, length + 1, format, args);
+  return text;
+}
+
+// Formats into the frame arena.
+const char *UI_FrameFormat(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  const char *text = UI_FrameFormatV(format, args);
+  va_end(args);
+  return text;
+}
+
+// UI Frame Scheduling
+
+// Process wide, a main loop waiting for events is woken with one of these.
+SDL_atomic_t ui_frame_event;
+SDL_atomic_t ui_frame_requested;
+
+// Asks for another frame, e.g. once a producer has new content, from any
+// thread. Wakes a main loop waiting in SDL_WaitEvent(), requests are
+// coalesced until UI_TakeFrameRequest().
+void UI_RequestFrame() {
+  if (!SDL_AtomicCAS(&ui_frame_requested, 0, 1)) {
+    return;
+  }
+  if (SDL_AtomicGet(&ui_frame_event) == 0) {
+    // A race registers a spare type, which is harmless.
+    SDL_AtomicCAS(&ui_frame_event, 0, (i32)SDL_RegisterEvents(1));
+  }
+  SDL_Event event = {.type = (u32)SDL_AtomicGet(&ui_frame_event)};
+  if (event.type != (u32)-1) {
+    SDL_PushEvent(&event);
+  }
+}
+
+// Returns true if a frame was requested since the last call.
+bool UI_TakeFrameRequest() {
+  return SDL_AtomicSet(&ui_frame_requested, 0) != 0;
+}
+
+// Returns true while ctx's last frame built had tweens running, with when
+// the last of them ends in deadline. Until then the frames have to keep
+// coming, from any thread.
+bool UI_GetAnimationDeadline(UI_Context *ctx, u32 *deadline) {
+  *deadline = SDL_AtomicGet(&ctx->animation_deadline);
+  return *deadline != 0;
+}
+
+// UI Overlays
+
+void UI_DestroyOverlayBuffer(UI_OverlayBuffer *buffer) {
+  if (buffer == NULL) {
+    return;
+  }
+  for (i32 i = 0; i < 3; i++) {
+    SDL_free(buffer->batches[i].cmds);
+  }
+  SDL_free(buffer);
+}
+
+// Returns NULL if out of memory or every buffer is taken. Any thread can
+// create a buffer, and record into it from then on without synchronizing
+// with the build. Only the creating thread may record into it, it's freed
+// with the context.
+UI_OverlayBuffer *UI_CreateOverlayBuffer(UI_Context *ctx) {
+  i32 index = SDL_AtomicAdd(&ctx->overlays_length, 1);
+  if (index >= UI_MAX_OVERLAY_BUFFER) {
+    SDL_SetError("Out of overlay buffers");
+    return NULL;
+  }
+  UI_OverlayBuffer *buffer = UI_Calloc(1, sizeof(UI_OverlayBuffer));
+  bool batches = buffer != NULL;
+  for (i32 i = 0; i < 3 && batches; i++) {
+    buffer->batches[i].cmds = UI_Calloc(UI_MAX_OVERLAY_CMD, sizeof(UI_OverlayCmd));
+    buffer->batches[i].capacity = UI_MAX_OVERLAY_CMD;
+    batches = buffer->batches[i].cmds != NULL;
+  }
+  if (!batches) {
+    UI_DestroyOverlayBuffer(buffer);
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  buffer->record = &buffer->batches[0];
+  buffer->merge = &buffer->batches[2];
+  SDL_AtomicSet(&buffer->mailbox, 1);
+  SDL_AtomicSetPtr((void **)&ctx->overlays[index], buffer);
+  return buffer;
+}
+
+// Records a cmd into the next batch. The merged order only depends on layer,
+// key and the cmd, never on which thread submitted first. The cmd is dropped
+// and counted if out of memory.
+void UI_PushOverlayCmd(UI_OverlayBuffer *buffer, u32 layer, u32 key, UI_DrawCmd cmd) {
+  UI_OverlayBatch *batch = buffer->record;
+  assert(cmd.type != UI_CLIP && cmd.type != UI_UNCLIP);
+  if (!UI_GrowArray((void **)&batch->cmds, &batch->capacity, batch->length + 1, sizeof(UI_OverlayCmd))) {
+    buffer->dropped++;
+    return;
+  }
+
+  // Cmds are compared bytewise, so bytes the payload doesn't use are zeroed.
+  UI_DrawPayload payload = {0};
+  if (cmd.type == UI_FILL) {
+    payload.color = cmd.payload.color;
+  } else if (cmd.type == UI_IMAGE) {
+    payload.image = cmd.payload.image;
+  }
+  cmd.payload = payload;
+  batch->cmds[batch->length++] = (UI_OverlayCmd){layer, key, cmd};
+}
+
+void UI_PushOverlayFill(UI_OverlayBuffer *buffer, u32 layer, u32 key, Rect rect, UI_Color color) {
+  UI_PushOverlayCmd(buffer, layer, key, (UI_DrawCmd){.type = UI_FILL, .rect = rect, .payload.color = color});
+}
+
+// Publishes the recorded batch, which replaces the buffer's previous one from
+// the next frame merged on, and starts an empty one.
+void UI_SubmitOverlay(UI_OverlayBuffer *buffer) {
+  i32 next = UI_ExchangeSlot(&buffer->mailbox, (i32)(buffer->record - buffer->batches) | UI_SLOT_FRESH);
+  buffer->record = &buffer->batches[next & ~UI_SLOT_FRESH];
+  buffer->record->length = 0;
+  UI_RequestFrame();
+}
+
+i32 UI_CompareOverlayCmds(const void *a, const void *b) {
+  const UI_OverlayCmd *x = a;
+  const UI_OverlayCmd *y = b;
+  if (x->layer != y->layer) {
+    return x->layer < y->layer ? -1 : 1;
+  }
+  if (x->key != y->key) {
+    return x->key < y->key ? -1 : 1;
+  }
+  return memcmp(&x->cmd, &y->cmd, sizeof(UI_DrawCmd));
+}
+
+// Appends the newest submitted batch of every overlay buffer to the draw
+// queue, on top of the build, sorted by layer then key. Call after building,
+// before UI_EndFrame(). Overlays aren't interactive, and are left out of
+// recordings.
+void UI_MergeOverlays() {
+  i32 length = 0;
+  i32 buffers = SDL_min(SDL_AtomicGet(&ui_ctx->overlays_length), UI_MAX_OVERLAY_BUFFER);
+  for (i32 i = 0; i < buffers; i++) {
+    UI_OverlayBuffer *buffer = SDL_AtomicGetPtr((void **)&ui_ctx->overlays[i]);
+    if (buffer == NULL) {
+      continue;
+    }
+    if (SDL_AtomicGet(&buffer->mailbox) & UI_SLOT_FRESH) {
+      i32 next = UI_ExchangeSlot(&buffer->mailbox, (i32)(buffer->merge - buffer->batches));
+      buffer->merge = &buffer->batches[next & ~UI_SLOT_FRESH];
+    }
+    if (!UI_GrowArray((void **)&ui_ctx->overlay_cmds, &ui_ctx->overlay_cmds_capacity, length + buffer->merge->length,
+                      sizeof(UI_OverlayCmd))) {
+      // Out of memory, the buffer is left out this frame.
+      continue;
+    }
+    memcpy(&ui_ctx->overlay_cmds[length], buffer->merge->cmds, buffer->merge->length * sizeof(UI_OverlayCmd));
+    length += buffer->merge->length;
+  }
+
+  SDL_qsort(ui_ctx->overlay_cmds, length, sizeof(UI_OverlayCmd), UI_CompareOverlayCmds);
+  for (i32 i = 0; i < length; i++) {
+    UI_AppendDrawCmd(&ui_ctx->overlay_cmds[i].cmd);
+  }
+}
+
+// UI Layout
+
+void UI_UpdateLayout(Rect *rect) {
+  switch (ui->layout) {
+    case UI_LAYOUT_HORIZONTAL:
+      ui->pos.x += rect->w + ui->margin.x;
+      break;
+    case UI_LAYOUT_VERTICAL:
+      ui->pos.y += rect->h + ui->margin.y;
+      break;
+  }
+  if (ui->bounds.x + ui->bounds.w < rect->x + rect->w) {
+    ui->bounds.w = rect->x + rect->w - ui->bounds.x;
+  }
+  if (ui->bounds.y + ui->bounds.h < rect->y + rect->h) {
+    ui->bounds.h = rect->y + rect->h - ui->bounds.y;
+  }
+}
+
+// UI Utils
+
+bool UI_MouseInRect(Rect *rect) {
+  v2 *mouse_pos = &ui_ctx->input_state.mouse_pos;
+  if (mouse_pos->x >= rect->x && mouse_pos->x <= rect->x + rect->w &&
+      mouse_pos->y >= rect->y && mouse_pos->y <= rect->y + rect->h) {
+    return true;
+  }
+
+  return false;
+}
+
+// Returns true if rect is fully outside the clip rect, in which case the
+// widget should skip its draw cmd. Layout must still be updated.
+bool UI_Cull(Rect *rect) {
+  if (SDL_HasIntersection(rect, &ui->clip)) {
+    return false;
+  }
+
+  ui_ctx->emit_culled++;
+  return true;
+}
+
+// UI Alignment
+// typedef struct {
+//   i32 start_index;
+//   v2 start_pos;
+//   UI_Align align;
+// } UI_AlignInfo;
+// 
+
+void UI_BeginAlign(UI_Align align, const u8 *label) {
+  if (!UI_GrowArray((void **)&ui_ctx->align_stack, &ui_ctx->align_stack_capacity, ui_ctx->align_stack_length + 1,
+                    sizeof(*ui_ctx->align_stack))) {
+    // Out of memory.
+    assert(false);
+  }
+  ui_ctx->align_stack[ui_ctx->align_stack_length++] = label;
+  ui_ctx->high_water.aligns = SDL_max(ui_ctx->high_water.aligns, ui_ctx->align_stack_length);
+  u32 id = ui_hash(label, strlen(label));
+  UI_Data *data = ui_get_data(id);
+  data->align.start_index = ui_ctx->build->draw_queue.length;
+  data->align.align = align;
+
+  UI_PushState();
+  ui->pos.x += data->align.x_offset;
+  ui->bounds.w = 0;
+  ui->bounds.h = 0;
+}
+
+void UI_EndAlign() {
+  const u8 *label = ui_ctx->align_stack[--ui_ctx->align_stack_length];
+  u32 id = ui_hash(label, strlen(label));
+  UI_Data *data = ui_get_data(id);
+  data->align.bounds = ui->bounds;
+  UI_PopState();
+
+  // TODO: Remove if, find a better way to stabilize.
+  if (data->align.x_offset == 0) {
+    switch (data->align.align) {
+      case UI_ALIGN_LEFT: {
+        i32 x = data->align.bounds.x;
+        data->align.x_offset = ui->bounds.x - x;
+      } break;
+      case UI_ALIGN_RIGHT: {
+        i32 x = data->align.bounds.x + data->align.bounds.w;
+        data->align.x_offset = ui->bounds.x + ui->bounds.w - x;
+      } break;
+    }
+  }
+  //printf("h = %d\n", data->align.bounds.h);
+  ui->bounds.h += data->align.bounds.h - ui->bounds.h;
+}
+
+// UI Widgets
+
+// UI Rect
+
+void UI_Rect(i32 w, i32 h) {
+  Rect rect = {ui->pos.x, ui->pos.y, w, h};
+  UI_UpdateLayout(&rect);
+  if (UI_Cull(&rect)) {
+    return;
+  }
+
+  UI_PushDrawCmd(UI_RECT, 0, rect);
+}
+
+// UI Button
+
+#define UI_BUTTON_FADE_MS 120
+
+// Idle, hovered and active.
+const UI_Color ui_button_colors[3] = {{0, 0, 100, 255}, {0, 0, 150, 255}, {0, 0, 200, 255}};
+
+// Consumes this frame's clicks on a button, returns how many there were. The
+// hover and active ids are already resolved from the input events.
+i32 UI_ButtonBehavior(u32 id) {
+  i32 clicks = 0;
+  for (i32 i = 0; i < ui_ctx->clicks_length; i++) {
+    if (ui_ctx->clicks[i] == id) {
+      ui_ctx->clicks[i] = 0;
+      clicks++;
+    }
+  }
+
+  return clicks;
+}
+
+// Returns the number of clicks this frame, e.g. 2 for a fast double click.
+i32 UI_ButtonClicks(const char *label) {
+  u32 id = ui_hash(label, strlen(label));
+  Rect rect = {ui->pos.x, ui->pos.y, 100, 50};
+
+  i32 clicks = UI_ButtonBehavior(id);
+
+  UI_UpdateLayout(&rect);
+  if (!UI_Cull(&rect)) {
+    i32 state = ui_ctx->active_id == id ? 2 : ui_ctx->hover_id == id ? 1 : 0;
+    UI_Color color = UI_TweenColor(id, ui_button_colors[state], UI_BUTTON_FADE_MS, UI_EASE_OUT);
+    i32 index = UI_PushDrawCmd(UI_BUTTON, id, rect);
+    UI_SetDrawCmdPayload(index, (UI_DrawPayload){.color = color});
+  }
+  return clicks;
+}
+
+bool UI_Button(const char *label) {
+  return UI_ButtonClicks(label) > 0;
+}
+
+// UI_Button() with a label formatted into the frame arena.
+bool UI_Buttonf(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  const char *label = UI_FrameFormatV(format, args);
+  va_end(args);
+  return UI_Button(label);
+}
+
+// UI Panel
+
+void UI_BeginPanel() {
+  UI_PushState();
+
+  // Start of panel. Store the index, and create rect cmd, which we'll adjust
+  // later in UI_EndPanel().
+  ui->bounds.x = ui->pos.x;
+  ui->bounds.y = ui->pos.y;
+  ui->bounds.w = 0;
+  ui->bounds.h = 0;
+  ui->index = UI_PushDrawCmd(UI_PANEL, 0, ui->bounds);
+  ui->pos.x += ui->padding.x;
+  ui->pos.y += ui->padding.y;
+}
+
+void UI_EndPanel() {
+  Rect rect = ui->bounds;
+  rect.w += ui->padding.x;
+  rect.h += ui->padding.y;
+  UI_SetDrawCmdRect(ui->index, rect);
+
+  // The children are inside the panel, so if they were all culled the panel
+  // may be culled too.
+  if (ui_ctx->build->draw_queue.length == ui->index + 1 && UI_Cull(&rect)) {
+    ui_ctx->build->draw_queue.length--;
+  }
+
+  UI_PopState();
+  UI_UpdateLayout(&rect);
+}
+
+// UI Scroll
+
+void UI_BeginScroll(const char *label, i32 w, i32 h) {
+  u32 id = ui_hash(label, strlen(label));
+  UI_Data *data = ui_get_data(id);
+  Rect viewport = {ui->pos.x, ui->pos.y, w, h};
+
+  if (id == ui_ctx->scroll_hover_id) {
+    data->scroll.offset.x -= ui_ctx->input_state.mouse_wheel.x * UI_SCROLL_STEP;
+    data->scroll.offset.y -= ui_ctx->input_state.mouse_wheel.y * UI_SCROLL_STEP;
+  }
+  // Clamp against last frame's content size, it may have shrunk.
+  data->scroll.offset.x = SDL_clamp(data->scroll.offset.x, 0, SDL_max(0, data->scroll.content.x - w));
+  data->scroll.offset.y = SDL_clamp(data->scroll.offset.y, 0, SDL_max(0, data->scroll.content.y - h));
+
+  data->scroll.size = (v2){w, h};
+
+  i32 index = UI_PushDrawCmd(UI_CLIP, id, viewport);
+
+  UI_PushState();
+  ui->index = index;
+  if (!SDL_IntersectRect(&viewport, &ui->clip, &ui->clip)) {
+    ui->clip = (Rect){viewport.x, viewport.y, 0, 0};
+  }
+  ui->pos.x = viewport.x - data->scroll.offset.x;
+  ui->pos.y = viewport.y - data->scroll.offset.y;
+  ui->bounds = (Rect){ui->pos.x, ui->pos.y, 0, 0};
+}
+
+void UI_EndScroll() {
+  u32 id = ui_ctx->build->draw_queue.id[ui->index];
+  UI_Data *data = ui_get_data(id);
+  data->scroll.content = (v2){ui->bounds.w, ui->bounds.h};
+
+  // Nested regions end first, so the innermost region claims the wheel.
+  if (ui_ctx->scroll_hover_next == 0 && UI_MouseInRect(&ui->clip)) {
+    ui_ctx->scroll_hover_next = id;
+  }
+
+  i32 index = UI_PushDrawCmd(UI_UNCLIP, id, ui->bounds);
+  UI_SetDrawCmdPayload(index, (UI_DrawPayload){.offset = data->scroll.offset});
+
+  UI_PopState();
+  Rect viewport = {ui->pos.x, ui->pos.y, data->scroll.size.x, data->scroll.size.y};
+  UI_UpdateLayout(&viewport);
+}
+
+// UI Memo
+
+bool UI_InCoordRange(Rect *rect) {
+  return rect->x > UI_COORD_MIN && rect->y > UI_COORD_MIN &&
+         rect->x + rect->w < UI_COORD_MAX && rect->y + rect->h < UI_COORD_MAX;
+}
+
+// Begins a memoized subtree. Returns false when inputs_hash matches the
+// previous frame, in which case the cached cmds have been replayed and the
+// widget code for the subtree should be skipped. UI_EndMemo() must always be
+// called.
+//
+//   if (UI_BeginMemo(id, inputs_hash)) {
+//     ...
+//   }
+//   UI_EndMemo();
+
+bool UI_BeginMemo(u32 id, u32 inputs_hash) {
+  assert(ui_ctx->memo_stack_length < ui_ctx->desc.max_memo);
+  ui_ctx->memo_stack[ui_ctx->memo_stack_length++] = id;
+  UI_Data *data = ui_get_data(id);
+
+  // The subtree is laid out as a group, so its effect on the parent layout
+  // is captured entirely by its bounds.
+  UI_PushState();
+  ui->index = ui_ctx->build->draw_queue.length;
+  ui->bounds = (Rect){ui->pos.x, ui->pos.y, 0, 0};
+  data->memo.emit_culled = ui_ctx->emit_culled;
+  data->memo.touched = ui_ctx->tweens.touched;
+
+  // Only last frame's buffer is still alive.
+  bool cached = data->memo.frame != 0 &&
+                data->memo.frame == ui_ctx->frame - 1 &&
+                data->memo.inputs_hash == inputs_hash;
+  if (!cached) {
+    data->memo.inputs_hash = inputs_hash;
+    return true;
+  }
+
+  // Widgets ease towards their hover and active looks, so rebuild while any
+  // are animating, or when the hovered or active widget enters or leaves.
+  UI_DrawCmd *cache = ui_ctx->memo_cache[(ui_ctx->frame - 1) & 1];
+  if (data->memo.animating) {
+    return true;
+  }
+  if (ui_ctx->hover_id != data->memo.hover_id || ui_ctx->active_id != data->memo.active_id) {
+    u32 ids[4] = {data->memo.hover_id, data->memo.active_id, ui_ctx->hover_id, ui_ctx->active_id};
+    for (i32 i = 0; i < data->memo.length; i++) {
+      u32 id = cache[data->memo.cache_index + i].id;
+      if (id != 0 && (id == ids[0] || id == ids[1] || id == ids[2] || id == ids[3])) {
+        return true;
+      }
+    }
+  }
+
+  v2 delta = {ui->pos.x - data->memo.origin.x, ui->pos.y - data->memo.origin.y};
+
+  // Culled cmds are missing from the cache, so they may become visible if
+  // the subtree moved or the clip rect changed.
+  if (data->memo.culled &&
+      (delta.x != 0 || delta.y != 0 || !SDL_RectEquals(&ui->clip, &data->memo.clip))) {
+    return true;
+  }
+  Rect bounds = data->memo.bounds;
+  bounds.x += delta.x;
+  bounds.y += delta.y;
+
+  // Cmds clamped to the coordinate range lost their true rects, and shifted
+  // cmds have to stay in range, so rebuild unless both are strictly inside.
+  Rect extent = data->memo.extent;
+  Rect shifted = {extent.x + delta.x, extent.y + delta.y, extent.w, extent.h};
+  if (!UI_InCoordRange(&extent) || !UI_InCoordRange(&shifted)) {
+    return true;
+  }
+
+  // Clicks can only be reported by running the widget code, so rebuild when
+  // the mouse is released over the subtree.
+  if (UI_InputEventInRect(UI_INPUT_MOUSE_UP, &bounds)) {
+    return true;
+  }
+
+  for (i32 i = 0; i < data->memo.length; i++) {
+    UI_DrawCmd cmd = cache[data->memo.cache_index + i];
+    cmd.rect.x += delta.x;
+    cmd.rect.y += delta.y;
+    UI_AppendDrawCmd(&cmd);
+  }
+  ui->bounds = bounds;
+
+  // The replayed range is still missing its culled cmds, so count them again
+  // for UI_EndMemo() and any enclosing subtree.
+  ui_ctx->emit_culled += data->memo.culled;
+
+  return false;
+}
+
+void UI_EndMemo() {
+  assert(ui_ctx->memo_stack_length > 0);
+  u32 id = ui_ctx->memo_stack[--ui_ctx->memo_stack_length];
+  UI_Data *data = ui_get_data(id);
+
+  // Record the range into this frame's buffer, for replay next frame. If out
+  // of memory it isn't, and the subtree is rebuilt next frame.
+  i32 length = ui_ctx->build->draw_queue.length - ui->index;
+  i32 *cache_length = &ui_ctx->memo_cache_length[ui_ctx->frame & 1];
+  if (!UI_GrowArray((void **)&ui_ctx->memo_cache[ui_ctx->frame & 1], &ui_ctx->memo_cache_capacity[ui_ctx->frame & 1],
+                    *cache_length + length, sizeof(UI_DrawCmd))) {
+    data->memo.frame = 0;
+    Rect bounds = ui->bounds;
+    UI_PopState();
+    UI_UpdateLayout(&bounds);
+    return;
+  }
+  i32 x0 = UI_COORD_MAX;
+  i32 y0 = UI_COORD_MAX;
+  i32 x1 = UI_COORD_MIN;
+  i32 y1 = UI_COORD_MIN;
+  for (i32 i = 0; i < length; i++) {
+    UI_DrawCmd cmd = UI_GetDrawCmd(&ui_ctx->build->draw_queue, ui->index + i);
+    ui_ctx->memo_cache[ui_ctx->frame & 1][*cache_length + i] = cmd;
+    x0 = SDL_min(x0, cmd.rect.x);
+    y0 = SDL_min(y0, cmd.rect.y);
+    x1 = SDL_max(x1, cmd.rect.x + cmd.rect.w);
+    y1 = SDL_max(y1, cmd.rect.y + cmd.rect.h);
+  }
+  data->memo.extent = length > 0 ? (Rect){x0, y0, x1 - x0, y1 - y0} : (Rect){0, 0, 0, 0};
+  data->memo.frame = ui_ctx->frame;
+  data->memo.clip = ui->clip;
+  data->memo.culled = ui_ctx->emit_culled - data->memo.emit_culled;
+  data->memo.hover_id = ui_ctx->hover_id;
+  data->memo.active_id = ui_ctx->active_id;
+  data->memo.animating = ui_ctx->tweens.touched != data->memo.touched;
+  data->memo.origin = (v2){ui->bounds.x, ui->bounds.y};
+  data->memo.bounds = ui->bounds;
+  data->memo.cache_index = *cache_length;
+  data->memo.length = length;
+  *cache_length += length;
+
+  Rect bounds = ui->bounds;
+  UI_PopState();
+  UI_UpdateLayout(&bounds);
+}
+
+// UI Deferred Subtrees
+
+i32 UI_CompareDeferredEntries(const void *a, const void *b) {
+  const UI_DeferredEntry *x = a;
+  const UI_DeferredEntry *y = b;
+  if (x->priority != y->priority) {
+    return x->priority > y->priority ? -1 : 1;
+  }
+  return 0;
+}
+
+void UI_SetBuildBudget(f32 ms) {
+  ui_ctx->build_budget = ms;
+}
+
+// Picks the deferred subtrees to build this frame, from those seen last
+// frame: by priority, plus a point for every frame a subtree has been
+// waiting so none starves, while their last build times fit the budget.
+// Called by UI_Clear().
+void UI_PlanDeferred() {
+  ui_ctx->deferred_replayed = 0;
+  if (ui_ctx->build_budget <= 0) {
+    ui_ctx->deferred_length = 0;
+    return;
+  }
+
+  for (i32 i = 0; i < ui_ctx->deferred_length; i++) {
+    UI_DeferredEntry *entry = &ui_ctx->deferred[i];
+    entry->priority += ui_ctx->frame - ui_get_data(entry->id)->memo.built;
+  }
+  SDL_qsort(ui_ctx->deferred, ui_ctx->deferred_length, sizeof(UI_DeferredEntry), UI_CompareDeferredEntries);
+  f32 spent = 0;
+  for (i32 i = 0; i < ui_ctx->deferred_length; i++) {
+    UI_Data *data = ui_get_data(ui_ctx->deferred[i].id);
+    // The first always fits, or a subtree over budget would never refresh.
+    if (i == 0 || spent + data->memo.cost <= ui_ctx->build_budget) {
+      data->memo.planned = ui_ctx->frame;
+      spent += data->memo.cost;
+    }
+  }
+  ui_ctx->deferred_length = 0;
+}
+
+// Begins a subtree that can be deferred: past the frame's build budget, it
+// replays its previous frame's cmds rather than building, and is built again
+// on a later frame. Interactive parts outside of deferred subtrees are built
+// every frame. Input over the subtree still rebuilds it, like UI_BeginMemo(),
+// and so does UI_EndDeferred() have to always be called.
+//
+//   if (UI_BeginDeferred(id, priority)) {
+//     ...
+//   }
+//   UI_EndDeferred();
+bool UI_BeginDeferred(u32 id, i32 priority) {
+  if (!UI_GrowArray((void **)&ui_ctx->deferred, &ui_ctx->deferred_capacity,
+                    ui_ctx->deferred_length + 1, sizeof(UI_DeferredEntry))) {
+    // Out of memory.
+    assert(false);
+  }
+  ui_ctx->deferred[ui_ctx->deferred_length++] = (UI_DeferredEntry){id, priority};
+
+  // A matching inputs hash replays the cached range, when there is one.
+  UI_Data *data = ui_get_data(id);
+  bool build = ui_ctx->build_budget <= 0 || data->memo.planned == ui_ctx->frame;
+  if (!UI_BeginMemo(id, build ? ui_ctx->frame : data->memo.inputs_hash)) {
+    ui_ctx->deferred_replayed++;
+    return false;
+  }
+  data->memo.build_start = SDL_GetPerformanceCounter();
+  return true;
+}
+
+void UI_EndDeferred() {
+  assert(ui_ctx->memo_stack_length > 0);
+  UI_Data *data = ui_get_data(ui_ctx->memo_stack[ui_ctx->memo_stack_length - 1]);
+  if (data->memo.build_start != 0) {
+    u64 elapsed = SDL_GetPerformanceCounter() - data->memo.build_start;
+    data->memo.cost = elapsed * 1000.0 / SDL_GetPerformanceFrequency();
+    data->memo.built = ui_ctx->frame;
+    data->memo.build_start = 0;
+  }
+  UI_EndMemo();
+}
+
+// UI Culling
+
+// Drops cmds outside of the window or their scroll region, and trims solid
+// fills to their visible part. Runs between building and rendering.
+void UI_CullDrawQueue() {
+  UI_DrawQueue *queue = &ui_ctx->build->draw_queue;
+  ui_ctx->high_water.draw_cmds = SDL_max(ui_ctx->high_water.draw_cmds, queue->length);
+  UI_ReserveScratch(queue->length);
+
+  // Test every cmd against the window in a single pass over the lanes, which
+  // the compiler can vectorize. Only scroll regions need the clip stack.
+  u8 *in_window = ui_ctx->in_window;
+  for (i32 i = 0; i < queue->length; i++) {
+    in_window[i] = (queue->w[i] > 0) & (queue->h[i] > 0) &
+                   (queue->x[i] < WINDOW_WIDTH) & (queue->x[i] + queue->w[i] > 0) &
+                   (queue->y[i] < WINDOW_HEIGHT) & (queue->y[i] + queue->h[i] > 0);
+  }
+
+  Rect *clips = ui_ctx->clips;
+  i32 clips_length = 0;
+  clips[clips_length++] = (Rect){0, 0, WINDOW_WIDTH, WINDOW_HEIGHT};
+
+  ui_ctx->cull_stats = (UI_CullStats){0};
+  i32 length = 0;
+  for (i32 i = 0; i < queue->length; i++) {
+    Rect *clip = &clips[clips_length - 1];
+    switch (queue->type[i]) {
+      case UI_CLIP: {
+        Rect rect = UI_GetDrawCmdRect(queue, i);
+        Rect next;
+        if (!in_window[i] || !SDL_IntersectRect(&rect, clip, &next)) {
+          // Drop the whole region.
+          i32 end = UI_FindUnclip(queue, i);
+          ui_ctx->cull_stats.culled += end - i + 1;
+          i = end;
+          continue;
+        }
+        clips[clips_length++] = next;
+      } break;
+      case UI_UNCLIP:
+        clips_length--;
+        break;
+      default: {
+        if (!in_window[i]) {
+          ui_ctx->cull_stats.culled++;
+          continue;
+        }
+        // Buttons have an outline, and images would need a source rect.
+        bool trim = queue->type[i] == UI_RECT || queue->type[i] == UI_PANEL || queue->type[i] == UI_FILL;
+        if (clips_length == 1 && !trim) {
+          break;
+        }
+        Rect rect = UI_GetDrawCmdRect(queue, i);
+        Rect visible;
+        if (!SDL_IntersectRect(&rect, clip, &visible)) {
+          ui_ctx->cull_stats.culled++;
+          continue;
+        }
+        if (trim && !SDL_RectEquals(&visible, &rect)) {
+          UI_SetDrawCmdRect(i, visible);
+          ui_ctx->cull_stats.trimmed++;
+        }
+      } break;
+    }
+    UI_MoveDrawCmd(length++, i);
+    ui_ctx->cull_stats.visible++;
+  }
+  queue->length = length;
+}
+
+// UI Occlusion
+
+#define UI_OCCLUSION_COLUMNS ((WINDOW_WIDTH + UI_OCCLUSION_TILE - 1) / UI_OCCLUSION_TILE)
+#define UI_OCCLUSION_ROWS ((WINDOW_HEIGHT + UI_OCCLUSION_TILE - 1) / UI_OCCLUSION_TILE)
+#define UI_OCCLUSION_WORDS ((UI_OCCLUSION_COLUMNS + 63) / 64)
+
+// One bit per tile, set when the tile is fully covered by opaque cmds.
+typedef struct {
+  u64 rows[UI_OCCLUSION_ROWS][UI_OCCLUSION_WORDS];
+} UI_CoverageMask;
+
+// Returns the bits for columns [c0, c1) that fall in word.
+u64 UI_ColumnMask(i32 word, i32 c0, i32 c1) {
+  i32 lo = SDL_max(c0 - word * 64, 0);
+  i32 hi = SDL_min(c1 - word * 64, 64);
+  if (lo >= hi) {
+    return 0;
+  }
+  u64 mask = hi == 64 ? ~0ull : (1ull << hi) - 1;
+  return mask & ~((1ull << lo) - 1);
+}
+
+// Returns true if every tile touched by rect is covered.
+bool UI_Covered(UI_CoverageMask *mask, Rect *rect) {
+  Rect window = {0, 0, WINDOW_WIDTH, WINDOW_HEIGHT};
+  Rect r;
+  if (!SDL_IntersectRect(rect, &window, &r)) {
+    return true;
+  }
+  i32 c0 = r.x / UI_OCCLUSION_TILE;
+  i32 c1 = (r.x + r.w - 1) / UI_OCCLUSION_TILE + 1;
+  i32 r0 = r.y / UI_OCCLUSION_TILE;
+  i32 r1 = (r.y + r.h - 1) / UI_OCCLUSION_TILE + 1;
+  for (i32 row = r0; row < r1; row++) {
+    for (i32 word = 0; word < UI_OCCLUSION_WORDS; word++) {
+      u64 bits = UI_ColumnMask(word, c0, c1);
+      if ((mask->rows[row][word] & bits) != bits) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Marks the tiles fully inside rect as covered.
+void UI_Cover(UI_CoverageMask *mask, Rect *rect) {
+  Rect window = {0, 0, WINDOW_WIDTH, WINDOW_HEIGHT};
+  Rect r;
+  if (!SDL_IntersectRect(rect, &window, &r)) {
+    return;
+  }
+  i32 c0 = (r.x + UI_OCCLUSION_TILE - 1) / UI_OCCLUSION_TILE;
+  i32 c1 = (r.x + r.w) / UI_OCCLUSION_TILE;
+  i32 r0 = (r.y + UI_OCCLUSION_TILE - 1) / UI_OCCLUSION_TILE;
+  i32 r1 = (r.y + r.h) / UI_OCCLUSION_TILE;
+  for (i32 row = r0; row < r1; row++) {
+    for (i32 word = 0; word < UI_OCCLUSION_WORDS; word++) {
+      mask->rows[row][word] |= UI_ColumnMask(word, c0, c1);
+    }
+  }
+}
+
+// Drops cmds that are hidden behind later opaque cmds. Walks the queue back
+// to front, so the coverage only holds cmds drawn on top. Scroll regions are
+// composited from a cached texture, so they're kept or dropped as a whole.
+// Runs after UI_CullDrawQueue().
+void UI_OccludeDrawQueue() {
+  UI_DrawQueue *queue = &ui_ctx->build->draw_queue;
+  UI_ReserveScratch(queue->length);
+  bool *keep = ui_ctx->keep;
+  UI_CoverageMask mask = {0};
+
+  for (i32 i = queue->length - 1; i >= 0; i--) {
+    if (queue->type[i] == UI_UNCLIP) {
+      i32 start = UI_FindClip(queue, i);
+      Rect viewport = UI_GetDrawCmdRect(queue, start);
+      bool visible = !UI_Covered(&mask, &viewport);
+      for (i32 j = start; j <= i; j++) {
+        keep[j] = visible;
+      }
+      i = start;
+      continue;
+    }
+
+    Rect rect = UI_GetDrawCmdRect(queue, i);
+    keep[i] = !UI_Covered(&mask, &rect);
+    // Images may have transparent pixels, and translucent colors blend over
+    // the cmds under them.
+    bool opaque = false;
+    switch (queue->type[i]) {
+      case UI_BUTTON:
+      case UI_FILL:
+        opaque = queue->payloads[queue->payload[i]].color.a == 255;
+        break;
+      case UI_RECT:
+      case UI_PANEL:
+        opaque = true;
+        break;
+      default:
+        break;
+    }
+    if (keep[i] && opaque) {
+      UI_Cover(&mask, &rect);
+    }
+  }
+
+  i32 length = 0;
+  for (i32 i = 0; i < queue->length; i++) {
+    if (keep[i]) {
+      UI_MoveDrawCmd(length++, i);
+    }
+  }
+  ui_ctx->cull_stats.occluded = queue->length - length;
+  ui_ctx->cull_stats.visible -= ui_ctx->cull_stats.occluded;
+  queue->length = length;
+}
+
+// UI Dynamic Resolution
+
+// Renders at a reduced scale while the rolling average of the render and
+// present times is over deadline ms, 0 disables it. Meant for software
+// renderers, without vsync, which would count the wait. With native_hover,
+// the hovered and pressed buttons are still drawn at native resolution.
+// Call on the rendering thread.
+void UI_SetDynamicResolution(f32 deadline, bool native_hover) {
+  UI_DynamicResolution *resolution = &ui_ctx->resolution;
+  resolution->deadline = deadline;
+  resolution->native_hover = native_hover;
+  resolution->level = 0;
+  resolution->samples_length = 0;
+}
+
+// Returns the scale the next frame is rendered at.
+f32 UI_GetResolutionScale() {
+  return ui_resolution_scales[ui_ctx->resolution.level];
+}
+
+void UI_ReleaseResolution(UI_DynamicResolution *resolution) {
+  if (resolution->target) {
+    SDL_DestroyTexture(resolution->target);
+    resolution->target = NULL;
+  }
+  resolution->w = 0;
+  resolution->h = 0;
+}
+
+// Picks the scale from the average of a full window of samples. The cost
+// goes with the area, so a higher scale is only taken back once the average
+// scaled up to it leaves some headroom, otherwise the scale would flip back
+// and forth.
+void UI_UpdateResolution(UI_DynamicResolution *resolution, f32 elapsed) {
+  resolution->samples[resolution->samples_length++ % UI_RESOLUTION_SAMPLES] = elapsed;
+  if (resolution->samples_length < UI_RESOLUTION_SAMPLES) {
+    return;
+  }
+  f32 average = 0;
+  for (i32 i = 0; i < UI_RESOLUTION_SAMPLES; i++) {
+    average += resolution->samples[i];
+  }
+  average /= UI_RESOLUTION_SAMPLES;
+
+  i32 level = resolution->level;
+  if (average > resolution->deadline) {
+    level = SDL_min(level + 1, (i32)SDL_arraysize(ui_resolution_scales) - 1);
+  } else if (level > 0) {
+    f32 ratio = ui_resolution_scales[level - 1] / ui_resolution_scales[level];
+    if (average * ratio * ratio < resolution->deadline * 0.75f) {
+      level--;
+    }
+  }
+  if (level != resolution->level) {
+    resolution->level = level;
+    resolution->samples_length = 0;
+  }
+}
+
+// UI Late Latch
+
+// Re-samples the pointer right before rendering, and updates the hover and
+// active ids from the hit index without rebuilding, so the feedback reflects
+// where the pointer is now rather than where it was before building. Only
+// the pointer over the context's own window, and its own presses, count.
+//
+// Reads the pointer state as last pumped, the caller pumps events if it's on
+// the main thread.
+void UI_LateLatch() {
+  UI_Frame *frame = ui_ctx->render;
+  SDL_Window *window = SDL_RenderGetWindow(ui_ctx->renderer);
+  u32 window_id = SDL_GetWindowID(window);
+  if (SDL_GetMouseFocus() == window) {
+    v2 pos;
+    SDL_GetMouseState(&pos.x, &pos.y);
+    frame->hover_id = UI_HitTest(&frame->hit_index, pos);
+  }
+
+  // Presses still queued are resolved next frame, against the same index, so
+  // they can already be shown. Stop at the first release, which has to be
+  // resolved before any later press.
+  SDL_Event events[16];
+  i32 count = SDL_PeepEvents(events, 16, SDL_PEEKEVENT, SDL_MOUSEBUTTONDOWN, SDL_MOUSEBUTTONUP);
+  for (i32 i = 0; i < count && frame->active_id == 0; i++) {
+    if (events[i].button.windowID != window_id || events[i].button.button != SDL_BUTTON_LEFT) {
+      continue;
+    }
+    if (events[i].type == SDL_MOUSEBUTTONUP) {
+      break;
+    }
+    frame->active_id = UI_HitTest(&frame->hit_index, (v2){events[i].button.x, events[i].button.y});
+  }
+
+  frame->latch_time = SDL_GetPerformanceCounter();
+}
+
+// Records the sample to present and event to present times, call right after
+// presenting.
+void UI_FramePresented() {
+  UI_Frame *frame = ui_ctx->render;
+  u64 now = SDL_GetPerformanceCounter();
+  f64 ms = 1000.0 / SDL_GetPerformanceFrequency();
+  ui_ctx->latch_stats.count++;
+  ui_ctx->latch_stats.early += (now - frame->sample_time) * ms;
+  ui_ctx->latch_stats.late += (now - frame->latch_time) * ms;
+
+  UI_MarkLatency(frame, UI_LATENCY_PRESENTED);
+  UI_RecordLatency(frame);
+
+  UI_DynamicResolution *resolution = &ui_ctx->resolution;
+  if (resolution->deadline > 0) {
+    UI_UpdateResolution(resolution, (now - resolution->render_start) * ms);
+  }
+}
+
+// UI Latency Overlay
+
+#define UI_LATENCY_BAR_BUCKETS 8
+#define UI_LATENCY_BARS (UI_LATENCY_BUCKETS / UI_LATENCY_BAR_BUCKETS)
+#define UI_LATENCY_BAR_WIDTH 8
+#define UI_LATENCY_ROW_HEIGHT 40
+
+const UI_Color ui_latency_colors[UI_LATENCY_STAGE_COUNT] = {
+  {80, 160, 220, 255},
+  {80, 200, 120, 255},
+  {220, 160, 60, 255},
+};
+
+void UI_PushFill(Rect rect, UI_Color color) {
+  i32 index = UI_PushDrawCmd(UI_FILL, 0, rect);
+  UI_SetDrawCmdPayload(index, (UI_DrawPayload){.color = color});
+}
+
+// Draws a histogram per stage in the bottom right corner of the window, with
+// p50, p95 and p99 markers. Pushed straight into the draw queue after the
+// build, so it is on top and left out of recordings.
+void UI_LatencyOverlay() {
+  i32 width = UI_LATENCY_BARS * UI_LATENCY_BAR_WIDTH;
+  i32 height = UI_LATENCY_STAGE_COUNT * UI_LATENCY_ROW_HEIGHT;
+  Rect background = {WINDOW_WIDTH - width - 20, WINDOW_HEIGHT - height - 20, width + 10, height + 10};
+  UI_PushFill(background, (UI_Color){20, 20, 20, 255});
+
+  UI_LatencyHistogram latency[UI_LATENCY_STAGE_COUNT];
+  UI_GetLatency(latency);
+  for (i32 stage = 0; stage < UI_LATENCY_STAGE_COUNT; stage++) {
+    UI_LatencyHistogram *histogram = &latency[stage];
+    i32 x = background.x + 5;
+    i32 bottom = background.y + 5 + (stage + 1) * UI_LATENCY_ROW_HEIGHT;
+
+    u32 bars[UI_LATENCY_BARS] = {0};
+    u32 max = 1;
+    for (i32 i = 0; i < UI_LATENCY_BUCKETS; i++) {
+      bars[i / UI_LATENCY_BAR_BUCKETS] += histogram->buckets[i];
+    }
+    for (i32 i = 0; i < UI_LATENCY_BARS; i++) {
+      max = SDL_max(max, bars[i]);
+    }
+    for (i32 i = 0; i < UI_LATENCY_BARS; i++) {
+      i32 h = bars[i] * (UI_LATENCY_ROW_HEIGHT - 4) / max;
+      if (h > 0) {
+        UI_PushFill((Rect){x + i * UI_LATENCY_BAR_WIDTH, bottom - h, UI_LATENCY_BAR_WIDTH - 1, h},
+                    ui_latency_colors[stage]);
+      }
+    }
+
+    if (histogram->count == 0) {
+      continue;
+    }
+    const f32 percentiles[] = {0.5f, 0.95f, 0.99f};
+    const UI_Color markers[] = {{255, 255, 255, 255}, {255, 220, 0, 255}, {255, 40, 40, 255}};
+    for (i32 i = 0; i < 3; i++) {
+      i32 ms = UI_LatencyPercentile(histogram, percentiles[i]);
+      i32 marker_x = x + ms * UI_LATENCY_BAR_WIDTH / UI_LATENCY_BAR_BUCKETS;
+      UI_PushFill((Rect){marker_x, bottom - UI_LATENCY_ROW_HEIGHT + 2, 2, UI_LATENCY_ROW_HEIGHT - 2}, markers[i]);
+    }
+  }
+}
+
+// END UI library
+
+// UI Renderer
+
+void UI_FlushImages() {
+  UI_ImageBatch *batch = &ui_ctx->images->batch;
+  if (batch->length > 0) {
+    SDL_RenderGeometry(ui_ctx->renderer, batch->texture, batch->vertices, batch->length * 4,
+                       batch->indices, batch->length * 6);
+    batch->length = 0;
+  }
+}
+
+void UI_BatchImage(SDL_Texture *texture, Rect src, Rect dst) {
+  UI_ImageBatch *batch = &ui_ctx->images->batch;
+  if (batch->texture != texture || batch->length == UI_MAX_IMAGE_BATCH) {
+    UI_FlushImages();
+    batch->texture = texture;
+  }
+
+  f32 u0 = (f32)src.x / UI_ATLAS_PAGE_SIZE;
+  f32 v0 = (f32)src.y / UI_ATLAS_PAGE_SIZE;
+  f32 u1 = (f32)(src.x + src.w) / UI_ATLAS_PAGE_SIZE;
+  f32 v1 = (f32)(src.y + src.h) / UI_ATLAS_PAGE_SIZE;
+  f32 x0 = dst.x;
+  f32 y0 = dst.y;
+  f32 x1 = dst.x + dst.w;
+  f32 y1 = dst.y + dst.h;
+  SDL_Color white = {255, 255, 255, 255};
+  SDL_Vertex *vertex = &batch->vertices[batch->length * 4];
+  vertex[0] = (SDL_Vertex){{x0, y0}, white, {u0, v0}};
+  vertex[1] = (SDL_Vertex){{x1, y0}, white, {u1, v0}};
+  vertex[2] = (SDL_Vertex){{x1, y1}, white, {u1, v1}};
+  vertex[3] = (SDL_Vertex){{x0, y1}, white, {u0, v1}};
+  i32 *index = &batch->indices[batch->length * 6];
+  i32 first = batch->length * 4;
+  const i32 quad[6] = {0, 1, 2, 0, 2, 3};
+  for (i32 i = 0; i < 6; i++) {
+    index[i] = first + quad[i];
+  }
+  batch->length++;
+}
+
+void UI_RenderCmd(UI_DrawCmd *cmd, v2 origin) {
+  Rect rect = cmd->rect;
+  rect.x -= origin.x;
+  rect.y -= origin.y;
+  // Anything else drawn in between would end up under the batched images.
+  bool atlas_image = cmd->type == UI_IMAGE &&
+                     SDL_AtomicGet(&((UI_ImageEntry *)cmd->payload.image)->state) == UI_IMAGE_LOADED &&
+                     ((UI_ImageEntry *)cmd->payload.image)->page >= 0;
+  if (!atlas_image) {
+    UI_FlushImages();
+  }
+  switch (cmd->type) {
+    case UI_RECT:
+      SDL_SetRenderDrawColor(ui_ctx->renderer, 255, 0, 0, 255);
+      SDL_RenderFillRect(ui_ctx->renderer, &rect);
+      break;
+    case UI_BUTTON: {
+      // Presses show at once, from the latched active id. Hover and release
+      // ease in from the build.
+      UI_Color color = cmd->payload.color;
+      if (ui_ctx->render->active_id == cmd->id) {
+        color = ui_button_colors[2];
+      }
+      SDL_SetRenderDrawColor(ui_ctx->renderer, color.r, color.g, color.b, color.a);
+      SDL_RenderFillRect(ui_ctx->renderer, &rect);
+      SDL_SetRenderDrawColor(ui_ctx->renderer, 0, 0, 0, 255);
+      SDL_RenderDrawRect(ui_ctx->renderer, &rect);
+    } break;
+    case UI_PANEL:
+      SDL_SetRenderDrawColor(ui_ctx->renderer, 0, 0, 0, 255);
+      SDL_RenderFillRect(ui_ctx->renderer, &rect);
+      break;
+    case UI_IMAGE: {
+      UI_ImageEntry *image = cmd->payload.image;
+      if (atlas_image) {
+        UI_BatchImage(ui_ctx->images->pages[image->page].texture, image->src, rect);
+      } else if (SDL_AtomicGet(&image->state) == UI_IMAGE_LOADED) {
+        SDL_RenderCopy(ui_ctx->renderer, image->texture, NULL, &rect);
+      } else {
+        // Still loading, or failed to.
+        SDL_SetRenderDrawColor(ui_ctx->renderer, 70, 70, 70, 255);
+        SDL_RenderFillRect(ui_ctx->renderer, &rect);
+      }
+    } break;
+    case UI_FILL:
+      SDL_SetRenderDrawColor(ui_ctx->renderer, cmd->payload.color.r, cmd->payload.color.g,
+                             cmd->payload.color.b, cmd->payload.color.a);
+      SDL_RenderFillRect(ui_ctx->renderer, &rect);
+      break;
+    case UI_CLIP:
+    case UI_UNCLIP:
+      break;
+  }
+}
+
+// Identifies what a cmd looks like, independent of its position.
+u32 UI_RenderCmdHash(UI_DrawCmd *cmd) {
+  i32 state = 0;
+  if (cmd->type == UI_BUTTON) {
+    state = ui_ctx->render->active_id == cmd->id;
+  } else if (cmd->type == UI_IMAGE) {
+    UI_ImageEntry *image = cmd->payload.image;
+    state = SDL_AtomicGet(&image->state) == UI_IMAGE_LOADED;
+    state += image->version << 1;
+  }
+  u32 hash = ui_hash(&cmd->id, sizeof(cmd->id));
+  hash = ui_hash_combine(hash, &cmd->type, sizeof(cmd->type));
+  hash = ui_hash_combine(hash, &cmd->payload, sizeof(cmd->payload));
+  hash = ui_hash_combine(hash, &state, sizeof(state));
+  return hash;
+}
+
+void UI_ReleaseRenderCache(UI_RenderCacheEntry *entry) {
+  for (i32 i = 0; i < 2; i++) {
+    if (entry->textures[i]) {
+      SDL_DestroyTexture(entry->textures[i]);
+      entry->textures[i] = NULL;
+    }
+  }
+  entry->valid = false;
+  entry->w = 0;
+  entry->h = 0;
+}
+
+// Returns NULL if the renderer can't render to textures.
+UI_RenderCacheEntry *UI_GetRenderCache(u32 id, i32 w, i32 h) {
+  if (!SDL_RenderTargetSupported(ui_ctx->renderer)) {
+    return NULL;
+  }
+
+  UI_RenderCacheEntry *entry = NULL;
+  UI_RenderCacheEntry *lru = &ui_ctx->render_cache[0];
+  for (i32 i = 0; i < ui_ctx->desc.max_render_cache; i++) {
+    if (ui_ctx->render_cache[i].id == id) {
+      entry = &ui_ctx->render_cache[i];
+      break;
+    }
+    if (ui_ctx->render_cache[i].frame < lru->frame) {
+      lru = &ui_ctx->render_cache[i];
+    }
+  }
+  if (!entry) {
+    entry = lru;
+    UI_ReleaseRenderCache(entry);
+    entry->id = id;
+  }
+  entry->frame = ui_ctx->render->frame;
+
+  if (entry->w != w || entry->h != h) {
+    UI_ReleaseRenderCache(entry);
+    for (i32 i = 0; i < 2; i++) {
+      entry->textures[i] = SDL_CreateTexture(ui_ctx->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, w, h);
+      if (!entry->textures[i]) {
+        UI_ReleaseRenderCache(entry);
+        return NULL;
+      }
+    }
+    entry->w = w;
+    entry->h = h;
+  }
+
+  return entry;
+}
+
+void UI_PushRenderedCmd(UI_RenderedList *list, UI_RenderedCmd rendered) {
+  if (list->length == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 64;
+    list->cmds = UI_Realloc(list->cmds, list->capacity * sizeof(UI_RenderedCmd));
+    assert(list->cmds);
+  }
+  list->cmds[list->length++] = rendered;
+}
+
+// Compares the cmds visible in band, in order. Returns false if they can't be
+// matched up, otherwise dirty is set to the area covered by the cmds that
+// changed, which is empty if none did.
+bool UI_DiffRenderedBand(UI_RenderedList *prev, UI_RenderedList *list, Rect *band, Rect *dirty) {
+  *dirty = (Rect){0, 0, 0, 0};
+  i32 i = 0;
+  i32 j = 0;
+  while (true) {
+    Rect a, b;
+    while (i < prev->length && !SDL_IntersectRect(&prev->cmds[i].rect, band, &a)) {
+      i++;
+    }
+    while (j < list->length && !SDL_IntersectRect(&list->cmds[j].rect, band, &b)) {
+      j++;
+    }
+    if (i == prev->length || j == list->length) {
+      return i == prev->length && j == list->length;
+    }
+    if (!SDL_RectEquals(&a, &b) || prev->cmds[i].hash != list->cmds[j].hash) {
+      SDL_UnionRect(dirty, &a, dirty);
+      SDL_UnionRect(dirty, &b, dirty);
+    }
+    i++;
+    j++;
+  }
+}
+
+i32 UI_RenderScroll(i32 index, v2 origin);
+
+// Renders cmds from index until the end of the queue or the end of the
+// enclosing scroll region, and returns the index it stopped at. When cull is
+// given, cmds outside of it are skipped.
+i32 UI_RenderCmds(i32 index, v2 origin, Rect *cull) {
+  UI_DrawQueue *queue = &ui_ctx->render->draw_queue;
+  while (index < queue->length) {
+    UI_DrawCmd cmd = UI_GetDrawCmd(queue, index);
+    if (cmd.type == UI_UNCLIP) {
+      break;
+    }
+    if (cmd.type == UI_CLIP) {
+      if (cull && !SDL_HasIntersection(&cmd.rect, cull)) {
+        index = UI_FindUnclip(queue, index) + 1;
+      } else {
+        UI_FlushImages();
+        index = UI_RenderScroll(index, origin);
+      }
+      continue;
+    }
+    if (!cull || SDL_HasIntersection(&cmd.rect, cull)) {
+      UI_RenderCmd(&cmd, origin);
+    }
+    index++;
+  }
+  UI_FlushImages();
+  return index;
+}
+
+// Renders the scroll region beginning at index, and returns the index after
+// its end.
+i32 UI_RenderScroll(i32 index, v2 origin) {
+  UI_DrawQueue *queue = &ui_ctx->render->draw_queue;
+  i32 end = UI_FindUnclip(queue, index);
+  Rect viewport = UI_GetDrawCmdRect(queue, index);
+  v2 offset = UI_GetDrawCmd(queue, end).payload.offset;
+  v2 content = {viewport.x - offset.x, viewport.y - offset.y};
+  Rect dst = {viewport.x - origin.x, viewport.y - origin.y, viewport.w, viewport.h};
+
+  Rect parent_clip;
+  bool parent_clipped = SDL_RenderIsClipEnabled(ui_ctx->renderer);
+  SDL_RenderGetClipRect(ui_ctx->renderer, &parent_clip);
+
+  // The cache holds native resolution pixels.
+  UI_RenderCacheEntry *entry = NULL;
+  if (!ui_ctx->resolution.scaled) {
+    entry = UI_GetRenderCache(queue->id[index], viewport.w, viewport.h);
+  }
+  if (!entry) {
+    // No render targets, so just clip.
+    Rect clip = dst;
+    if (parent_clipped && !SDL_IntersectRect(&dst, &parent_clip, &clip)) {
+      return end + 1;
+    }
+    SDL_RenderSetClipRect(ui_ctx->renderer, &clip);
+    UI_RenderCmds(index + 1, origin, NULL);
+    SDL_RenderSetClipRect(ui_ctx->renderer, parent_clipped ? &parent_clip : NULL);
+    return end + 1;
+  }
+
+  // Record this frame's cmds in content space.
+  UI_RenderedList *prev = &entry->lists[entry->list];
+  entry->list ^= 1;
+  UI_RenderedList *list = &entry->lists[entry->list];
+  list->length = 0;
+  for (i32 i = index + 1; i < end; i++) {
+    UI_DrawCmd cmd = UI_GetDrawCmd(queue, i);
+    Rect rect = cmd.rect;
+    rect.x -= content.x;
+    rect.y -= content.y;
+    UI_PushRenderedCmd(list, (UI_RenderedCmd){rect, UI_RenderCmdHash(&cmd)});
+  }
+
+  // The area visible in both frames, in content space. Its pixels can be
+  // reused, except where cmds changed.
+  Rect view = {offset.x, offset.y, viewport.w, viewport.h};
+  Rect prev_view = {entry->offset.x, entry->offset.y, viewport.w, viewport.h};
+  Rect band;
+  Rect dirty;
+  bool reuse = entry->valid &&
+               SDL_IntersectRect(&view, &prev_view, &band) &&
+               UI_DiffRenderedBand(prev, list, &band, &dirty);
+
+  SDL_Texture *target = SDL_GetRenderTarget(ui_ctx->renderer);
+  v2 texture_origin = {viewport.x, viewport.y};
+  if (!reuse) {
+    SDL_SetRenderTarget(ui_ctx->renderer, entry->textures[entry->texture]);
+    SDL_RenderSetClipRect(ui_ctx->renderer, NULL);
+    SDL_SetRenderDrawColor(ui_ctx->renderer, 0, 0, 0, 0);
+    SDL_RenderClear(ui_ctx->renderer);
+    UI_RenderCmds(index + 1, texture_origin, NULL);
+  } else {
+    v2 shift = {entry->offset.x - offset.x, entry->offset.y - offset.y};
+    if (shift.x != 0 || shift.y != 0) {
+      // Shift the pixels into the other texture.
+      SDL_Texture *src = entry->textures[entry->texture];
+      entry->texture ^= 1;
+      SDL_SetRenderTarget(ui_ctx->renderer, entry->textures[entry->texture]);
+      SDL_RenderSetClipRect(ui_ctx->renderer, NULL);
+      SDL_SetTextureBlendMode(src, SDL_BLENDMODE_NONE);
+      SDL_RenderCopy(ui_ctx->renderer, src, NULL, &(Rect){shift.x, shift.y, viewport.w, viewport.h});
+    } else {
+      SDL_SetRenderTarget(ui_ctx->renderer, entry->textures[entry->texture]);
+    }
+
+    // Rasterize the exposed strips and changed cmds, in texture space.
+    Rect damage[3] = {
+      {shift.x > 0 ? 0 : viewport.w + shift.x, 0, abs(shift.x), viewport.h},
+      {0, shift.y > 0 ? 0 : viewport.h + shift.y, viewport.w, abs(shift.y)},
+      {dirty.x - offset.x, dirty.y - offset.y, dirty.w, dirty.h},
+    };
+    for (i32 i = 0; i < 3; i++) {
+      if (SDL_RectEmpty(&damage[i])) {
+        continue;
+      }
+      Rect cull = damage[i];
+      cull.x += viewport.x;
+      cull.y += viewport.y;
+      SDL_RenderSetClipRect(ui_ctx->renderer, &damage[i]);
+      SDL_SetRenderDrawColor(ui_ctx->renderer, 0, 0, 0, 0);
+      SDL_RenderFillRect(ui_ctx->renderer, &damage[i]);
+      UI_RenderCmds(index + 1, texture_origin, &cull);
+    }
+  }
+  entry->valid = true;
+  entry->offset = offset;
+
+  SDL_SetRenderTarget(ui_ctx->renderer, target);
+  SDL_RenderSetClipRect(ui_ctx->renderer, parent_clipped ? &parent_clip : NULL);
+  SDL_Texture *texture = entry->textures[entry->texture];
+  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  SDL_RenderCopy(ui_ctx->renderer, texture, NULL, &dst);
+
+  return end + 1;
+}
+
+// Redirects rendering into the reduced scale target. Returns false to
+// render at native resolution.
+bool UI_BeginScaledRender() {
+  UI_DynamicResolution *resolution = &ui_ctx->resolution;
+  if (resolution->level == 0 || !SDL_RenderTargetSupported(ui_ctx->renderer)) {
+    return false;
+  }
+  f32 scale = ui_resolution_scales[resolution->level];
+  i32 w, h;
+  SDL_GetRendererOutputSize(ui_ctx->renderer, &w, &h);
+  w = SDL_max(1, (i32)(w * scale));
+  h = SDL_max(1, (i32)(h * scale));
+  if (resolution->w != w || resolution->h != h) {
+    UI_ReleaseResolution(resolution);
+    resolution->target = SDL_CreateTexture(ui_ctx->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, w, h);
+    if (!resolution->target) {
+      return false;
+    }
+    SDL_SetTextureBlendMode(resolution->target, SDL_BLENDMODE_BLEND);
+    SDL_SetTextureScaleMode(resolution->target, SDL_ScaleModeLinear);
+    resolution->w = w;
+    resolution->h = h;
+  }
+
+  SDL_SetRenderTarget(ui_ctx->renderer, resolution->target);
+  SDL_SetRenderDrawColor(ui_ctx->renderer, 0, 0, 0, 0);
+  SDL_RenderClear(ui_ctx->renderer);
+  SDL_RenderSetScale(ui_ctx->renderer, scale, scale);
+  resolution->scaled = true;
+  return true;
+}
+
+// Redraws the button with id at native resolution, over the upscaled frame.
+// Skipped if any later cmd overlaps it, since the button would cover it.
+void UI_RenderNative(u32 id) {
+  if (id == 0) {
+    return;
+  }
+  UI_Frame *frame = ui_ctx->render;
+  UI_HitIndex *index = &frame->hit_index;
+  i32 i = 0;
+  while (i < index->length && index->id[i] != id) {
+    i++;
+  }
+  if (i == index->length) {
+    return;
+  }
+  // Clipped to the enclosing scroll regions.
+  Rect clip = index->rect[i];
+
+  UI_DrawQueue *queue = &frame->draw_queue;
+  i32 found = -1;
+  for (i32 j = 0; j < queue->length; j++) {
+    if (found < 0) {
+      if (queue->id[j] == id && queue->type[j] == UI_BUTTON) {
+        found = j;
+      }
+      continue;
+    }
+    Rect rect = UI_GetDrawCmdRect(queue, j);
+    if (queue->type[j] != UI_CLIP && queue->type[j] != UI_UNCLIP && SDL_HasIntersection(&rect, &clip)) {
+      return;
+    }
+  }
+  if (found < 0) {
+    return;
+  }
+  UI_DrawCmd cmd = UI_GetDrawCmd(queue, found);
+  SDL_RenderSetClipRect(ui_ctx->renderer, &clip);
+  UI_RenderCmd(&cmd, (v2){0, 0});
+  SDL_RenderSetClipRect(ui_ctx->renderer, NULL);
+}
+
+// Upscales the target to the window.
+void UI_EndScaledRender() {
+  UI_DynamicResolution *resolution = &ui_ctx->resolution;
+  SDL_RenderSetScale(ui_ctx->renderer, 1, 1);
+  SDL_SetRenderTarget(ui_ctx->renderer, NULL);
+  SDL_RenderCopy(ui_ctx->renderer, resolution->target, NULL, NULL);
+  resolution->scaled = false;
+
+  if (resolution->native_hover) {
+    UI_Frame *frame = ui_ctx->render;
+    UI_RenderNative(frame->hover_id);
+    if (frame->active_id != frame->hover_id) {
+      UI_RenderNative(frame->active_id);
+    }
+  }
+}
+
+void UI_UpdateImages();
+
+// Renders the frame last taken by UI_AcquireFrame().
+void UI_Render() {
+  UI_UpdateImages();
+  ui_ctx->resolution.render_start = SDL_GetPerformanceCounter();
+  if (UI_BeginScaledRender()) {
+    UI_RenderCmds(0, (v2){0, 0}, NULL);
+    UI_EndScaledRender();
+  } else {
+    UI_RenderCmds(0, (v2){0, 0}, NULL);
+  }
+}
+
+void UI_ReleaseImages(UI_ImageEntry *entries, i32 count) {
+  for (i32 i = 0; i < count; i++) {
+    UI_ImageEntry *image = &entries[i];
+    if (SDL_AtomicGet(&image->state) == UI_IMAGE_LOADED) {
+      SDL_DestroyTexture(image->texture);
+      image->texture = NULL;
+      image->page = -1;
+      image->bytes = 0;
+      SDL_AtomicSet(&image->state, UI_IMAGE_UNLOADED);
+    }
+  }
+}
+
+// Releases what the context holds of its renderer, call on the rendering
+// thread before destroying the renderer.
+void UI_ReleaseRenderer() {
+  for (i32 i = 0; i < ui_ctx->desc.max_render_cache; i++) {
+    UI_ReleaseRenderCache(&ui_ctx->render_cache[i]);
+  }
+  UI_ReleaseResolution(&ui_ctx->resolution);
+  UI_ImageCache *cache = ui_ctx->images;
+  UI_ReleaseImages(cache->entries, cache->capacity);
+  for (i32 i = 0; i < SDL_AtomicGet(&cache->tile_sets_length); i++) {
+    UI_TileSet *set = &cache->tile_sets[i];
+    UI_ReleaseImages(set->tiles, set->source->level_tiles[set->source->levels]);
+  }
+  cache->bytes = 0;
+  for (i32 i = 0; i < SDL_min(SDL_AtomicGet(&cache->streams_length), UI_MAX_STREAM); i++) {
+    UI_Stream *stream = SDL_AtomicGetPtr((void **)&cache->streams[i]);
+    if (stream != NULL && stream->image.texture != NULL) {
+      SDL_DestroyTexture(stream->image.texture);
+      stream->image.texture = NULL;
+      SDL_AtomicSet(&stream->image.state, UI_IMAGE_UNLOADED);
+      // All of it is uploaded to the next renderer.
+      SDL_AtomicLock(&stream->lock);
+      stream->dirty[0] = (Rect){0, 0, stream->image.w, stream->image.h};
+      stream->dirty_length = 1;
+      SDL_AtomicUnlock(&stream->lock);
+    }
+  }
+  for (i32 i = 0; i < cache->pages_length; i++) {
+    SDL_DestroyTexture(cache->pages[i].texture);
+  }
+  cache->pages_length = 0;
+  cache->batch.length = 0;
+  ui_ctx->renderer = NULL;
+}
+
+// END UI Renderer
+
+// UI Recording
+
+#define UI_RECORDING_MAGIC 0x33524955 // "UIR3"
+
+// A recording is the magic followed by one record per frame:
+//
+//   u16 event count
+//   u32 frame time, the SDL_GetTicks() time its tweens were evaluated at
+//   i16 mouse x, mouse y
+//   i8  wheel x, wheel y
+//   per event: u8 type | button << 3, i16 x, y, u32 timestamp
+//   u32 draw queue checksum
+//
+// All multi-byte values are little endian.
+
+// Hashes everything the renderer reads from the draw queue, except image
+// pointers which differ between runs.
+u32 UI_DrawQueueChecksum() {
+  UI_DrawQueue *queue = &ui_ctx->build->draw_queue;
+  u32 hash = UI_HASH_SEED;
+  hash = ui_hash_combine(hash, &queue->length, sizeof(queue->length));
+  hash = ui_hash_combine(hash, queue->id, queue->length * sizeof(queue->id[0]));
+  hash = ui_hash_combine(hash, queue->type, queue->length * sizeof(queue->type[0]));
+  hash = ui_hash_combine(hash, queue->x, queue->length * sizeof(queue->x[0]));
+  hash = ui_hash_combine(hash, queue->y, queue->length * sizeof(queue->y[0]));
+  hash = ui_hash_combine(hash, queue->w, queue->length * sizeof(queue->w[0]));
+  hash = ui_hash_combine(hash, queue->h, queue->length * sizeof(queue->h[0]));
+  for (i32 i = 0; i < queue->length; i++) {
+    if (queue->type[i] == UI_UNCLIP) {
+      v2 offset = queue->payloads[queue->payload[i]].offset;
+      hash = ui_hash_combine(hash, &offset, sizeof(offset));
+    } else if (queue->type[i] == UI_BUTTON || queue->type[i] == UI_FILL) {
+      UI_Color color = queue->payloads[queue->payload[i]].color;
+      hash = ui_hash_combine(hash, &color, sizeof(color));
+    }
+  }
+  return hash;
+}
+
+bool UI_BeginRecording(const char *path) {
+  ui_ctx->recording = SDL_RWFromFile(path, "wb");
+  if (ui_ctx->recording == NULL) {
+    return false;
+  }
+  SDL_WriteLE32(ui_ctx->recording, UI_RECORDING_MAGIC);
+  return true;
+}
+
+// Writes this frame's input and the resulting draw queue checksum, call after
+// building and before UI_EndFrame().
+void UI_RecordFrame() {
+  // At most the ring's capacity.
+  u32 count = ui_ctx->input_events_head - ui_ctx->input_events_frame;
+  assert(count <= UINT16_MAX);
+
+  SDL_WriteLE16(ui_ctx->recording, count);
+  SDL_WriteLE32(ui_ctx->recording, ui_ctx->time);
+  SDL_WriteLE16(ui_ctx->recording, ui_ctx->input_state.mouse_pos.x);
+  SDL_WriteLE16(ui_ctx->recording, ui_ctx->input_state.mouse_pos.y);
+  SDL_WriteU8(ui_ctx->recording, ui_ctx->input_state.mouse_wheel.x);
+  SDL_WriteU8(ui_ctx->recording, ui_ctx->input_state.mouse_wheel.y);
+  for (u32 i = ui_ctx->input_events_frame; i != ui_ctx->input_events_head; i++) {
+    UI_InputEvent *event = &ui_ctx->input_events[i % ui_ctx->desc.max_input_event];
+    SDL_WriteU8(ui_ctx->recording, event->type | event->button << 3);
+    SDL_WriteLE16(ui_ctx->recording, event->pos.x);
+    SDL_WriteLE16(ui_ctx->recording, event->pos.y);
+    SDL_WriteLE32(ui_ctx->recording, event->timestamp);
+  }
+  SDL_WriteLE32(ui_ctx->recording, UI_DrawQueueChecksum());
+}
+
+void UI_EndRecording() {
+  if (ui_ctx->recording != NULL) {
+    SDL_RWclose(ui_ctx->recording);
+    ui_ctx->recording = NULL;
+  }
+}
+
+// Feeds a recording back through build as fast as possible, without a window
+// or renderer, and checks every frame's draw queue against the recorded
+// checksum. Returns false if the file is invalid or any frame differs.
+//
+// With the allocation audit installed and warmup >= 0, also fails if any frame
+// after the first warmup allocates, and reports where from.
+bool UI_Replay(const char *path, void (*build)(), i32 warmup) {
+  SDL_RWops *rw = SDL_RWFromFile(path, "rb");
+  if (rw == NULL) {
+    printf("[Replay]: %s\n", SDL_GetError());
+    return false;
+  }
+  if (SDL_ReadLE32(rw) != UI_RECORDING_MAGIC) {
+    printf("[Replay]: %s is not a recording\n", path);
+    SDL_RWclose(rw);
+    return false;
+  }
+
+  bool audit = ui_alloc_audit && warmup >= 0;
+  if (audit) {
+    UI_TakeAllocStats();
+  }
+
+  i32 frames = 0;
+  i32 mismatches = 0;
+  i32 allocating = 0;
+  u32 first_ticks = 0;
+  u32 last_ticks = 0;
+  u64 start = SDL_GetPerformanceCounter();
+  ui_ctx->replaying = true;
+  u16 count;
+  while (SDL_RWread(rw, &count, sizeof(count), 1) == 1) {
+    count = SDL_SwapLE16(count);
+    last_ticks = SDL_ReadLE32(rw);
+    if (frames == 0) {
+      first_ticks = last_ticks;
+    }
+    ui_ctx->input_state.mouse_pos.x = (i16)SDL_ReadLE16(rw);
+    ui_ctx->input_state.mouse_pos.y = (i16)SDL_ReadLE16(rw);
+    ui_ctx->input_state.mouse_wheel.x = (i8)SDL_ReadU8(rw);
+    ui_ctx->input_state.mouse_wheel.y = (i8)SDL_ReadU8(rw);
+    for (i32 i = 0; i < count; i++) {
+      u8 type = SDL_ReadU8(rw);
+      UI_InputEvent event = {.type = type & 7, .button = type >> 3};
+      event.pos.x = (i16)SDL_ReadLE16(rw);
+      event.pos.y = (i16)SDL_ReadLE16(rw);
+      event.timestamp = SDL_ReadLE32(rw);
+      UI_PushInputEvent(event);
+    }
+    u32 checksum = SDL_ReadLE32(rw);
+
+    ui_ctx->time = last_ticks;
+    build();
+    if (UI_DrawQueueChecksum() != checksum) {
+      if (mismatches == 0) {
+        printf("[Replay]: frame %d differs from the recording\n", frames);
+      }
+      mismatches++;
+    }
+    UI_EndFrame();
+    if (audit) {
+      UI_AllocStats stats = UI_TakeAllocStats();
+      if (frames >= warmup && stats.allocs > 0) {
+        UI_PrintAllocStats(frames, &stats);
+        allocating++;
+      }
+    }
+    frames++;
+  }
+  ui_ctx->replaying = false;
+  SDL_RWclose(rw);
+
+  f64 elapsed = (f64)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+  f64 recorded = (last_ticks - first_ticks) / 1000.0;
+  printf("Replayed %d frames in %.3f s, recorded over %.1f s (%.0fx real time), %d mismatched\n",
+         frames, elapsed, recorded, elapsed > 0 ? recorded / elapsed : 0.0, mismatches);
+  if (audit) {
+    printf("%d frames allocated after the first %d\n", allocating, warmup);
+  }
+  return mismatches == 0 && allocating == 0;
+}
+
+// END UI Recording
+
+// UI Thread Pool
+
+#define UI_MAX_THREAD 16
+#define UI_MAX_JOB 256
+
+typedef struct {
+  void (*fn)(void *data);
+  void *data;
+} UI_Job;
+
+typedef struct UI_ParallelWork {
+  UI_ThreadPool *pool;
+  void (*fn)(void *data, i32 index);
+  void *data;
+  i32 count;
+  // The next item to claim, and the number of items done.
+  SDL_atomic_t next;
+  SDL_atomic_t done;
+  // Held by the caller and every helper job, helpers may only start after
+  // the caller returned.
+  SDL_atomic_t refs;
+  struct UI_ParallelWork *next_free;
+} UI_ParallelWork;
+
+// A fixed set of workers taking jobs from one queue, in the order submitted.
+struct UI_ThreadPool {
+  SDL_mutex *mutex;
+  // Signalled when a job is queued, or the pool is destroyed.
+  SDL_cond *queued;
+  // Signalled when the last item of a UI_ParallelFor() is done.
+  SDL_cond *finished;
+  UI_Job jobs[UI_MAX_JOB];
+  u32 head;
+  u32 tail;
+  bool quit;
+  SDL_Thread *threads[UI_MAX_THREAD];
+  i32 threads_length;
+  // Released UI_ParallelFor() work, reused so the steady state allocates
+  // nothing.
+  UI_ParallelWork *free_work;
+};
+
+i32 UI_ThreadPoolWorker(void *data) {
+  UI_ThreadPool *pool = data;
+  SDL_LockMutex(pool->mutex);
+  for (;;) {
+    while (pool->head == pool->tail && !pool->quit) {
+      SDL_CondWait(pool->queued, pool->mutex);
+    }
+    if (pool->head == pool->tail) {
+      break;
+    }
+    UI_Job job = pool->jobs[pool->head++ % UI_MAX_JOB];
+    SDL_UnlockMutex(pool->mutex);
+    job.fn(job.data);
+    SDL_LockMutex(pool->mutex);
+  }
+  SDL_UnlockMutex(pool->mutex);
+  return 0;
+}
+
+// Returns NULL on failure. Threads are capped at UI_MAX_THREAD.
+UI_ThreadPool *UI_CreateThreadPool(i32 threads) {
+  UI_ThreadPool *pool = UI_Calloc(1, sizeof(UI_ThreadPool));
+  if (pool == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  pool->mutex = SDL_CreateMutex();
+  pool->queued = SDL_CreateCond();
+  pool->finished = SDL_CreateCond();
+  if (pool->mutex == NULL || pool->queued == NULL || pool->finished == NULL) {
+    SDL_DestroyCond(pool->finished);
+    SDL_DestroyCond(pool->queued);
+    SDL_DestroyMutex(pool->mutex);
+    SDL_free(pool);
+    return NULL;
+  }
+
+  threads = SDL_clamp(threads, 1, UI_MAX_THREAD);
+  for (i32 i = 0; i < threads; i++) {
+    SDL_Thread *thread = SDL_CreateThread(UI_ThreadPoolWorker, "UI Worker", pool);
+    if (thread == NULL) {
+      break;
+    }
+    pool->threads[pool->threads_length++] = thread;
+  }
+  return pool;
+}
+
+// Runs the jobs already submitted, then joins the workers.
+void UI_DestroyThreadPool(UI_ThreadPool *pool) {
+  if (pool == NULL) {
+    return;
+  }
+  SDL_LockMutex(pool->mutex);
+  pool->quit = true;
+  SDL_CondBroadcast(pool->queued);
+  SDL_UnlockMutex(pool->mutex);
+  for (i32 i = 0; i < pool->threads_length; i++) {
+    SDL_WaitThread(pool->threads[i], NULL);
+  }
+  while (pool->free_work != NULL) {
+    UI_ParallelWork *work = pool->free_work;
+    pool->free_work = work->next_free;
+    SDL_free(work);
+  }
+  SDL_DestroyCond(pool->finished);
+  SDL_DestroyCond(pool->queued);
+  SDL_DestroyMutex(pool->mutex);
+  SDL_free(pool);
+}
+
+// Runs fn(data) on a worker. Without any workers it runs on the caller.
+void UI_SubmitJob(UI_ThreadPool *pool, void (*fn)(void *data), void *data) {
+  if (pool->threads_length == 0) {
+    fn(data);
+    return;
+  }
+  SDL_LockMutex(pool->mutex);
+  assert(pool->tail - pool->head < UI_MAX_JOB);
+  pool->jobs[pool->tail++ % UI_MAX_JOB] = (UI_Job){fn, data};
+  SDL_CondSignal(pool->queued);
+  SDL_UnlockMutex(pool->mutex);
+}
+
+// Claims and runs items until none are left.
+void UI_RunParallelWork(UI_ParallelWork *work) {
+  for (i32 i; (i = SDL_AtomicAdd(&work->next, 1)) < work->count;) {
+    work->fn(work->data, i);
+    if (SDL_AtomicAdd(&work->done, 1) + 1 == work->count) {
+      SDL_LockMutex(work->pool->mutex);
+      SDL_CondBroadcast(work->pool->finished);
+      SDL_UnlockMutex(work->pool->mutex);
+    }
+  }
+}
+
+void UI_ReleaseParallelWork(UI_ParallelWork *work) {
+  if (SDL_AtomicDecRef(&work->refs)) {
+    UI_ThreadPool *pool = work->pool;
+    SDL_LockMutex(pool->mutex);
+    work->next_free = pool->free_work;
+    pool->free_work = work;
+    SDL_UnlockMutex(pool->mutex);
+  }
+}
+
+void UI_ParallelWorkJob(void *data) {
+  UI_RunParallelWork(data);
+  UI_ReleaseParallelWork(data);
+}
+
+// Runs fn(data, i) for every i in [0, count), on the caller and any idle
+// workers, and returns once all are done. Items are claimed one at a time,
+// so whoever is free takes the next one and uneven items balance out. The
+// caller works through the items too, so this is safe to call from a job,
+// and runs serially without a pool.
+void UI_ParallelFor(UI_ThreadPool *pool, i32 count, void (*fn)(void *data, i32 index), void *data) {
+  UI_ParallelWork *work = NULL;
+  if (pool != NULL) {
+    SDL_LockMutex(pool->mutex);
+    work = pool->free_work;
+    if (work != NULL) {
+      pool->free_work = work->next_free;
+    }
+    SDL_UnlockMutex(pool->mutex);
+    if (work == NULL) {
+      work = UI_Calloc(1, sizeof(UI_ParallelWork));
+    }
+  }
+  if (work == NULL) {
+    for (i32 i = 0; i < count; i++) {
+      fn(data, i);
+    }
+    return;
+  }
+  *work = (UI_ParallelWork){.pool = pool, .fn = fn, .data = data, .count = count};
+  i32 helpers = SDL_min(pool->threads_length, count - 1);
+  SDL_AtomicSet(&work->refs, helpers + 1);
+  for (i32 i = 0; i < helpers; i++) {
+    UI_SubmitJob(pool, UI_ParallelWorkJob, work);
+  }
+
+  UI_RunParallelWork(work);
+  SDL_LockMutex(pool->mutex);
+  while (SDL_AtomicGet(&work->done) < count) {
+    SDL_CondWait(pool->finished, pool->mutex);
+  }
+  SDL_UnlockMutex(pool->mutex);
+  UI_ReleaseParallelWork(work);
+}
+
+// END UI Thread Pool
+
+// UI Nodes
+
+// Returns the node's context, created on first use, or NULL if out of memory.
+UI_Context *UI_GetNodeContext(u32 id) {
+  for (i32 i = 0; i < ui_ctx->nodes_length; i++) {
+    if (ui_ctx->nodes[i].id == id) {
+      return ui_ctx->nodes[i].ctx;
+    }
+  }
+  assert(ui_ctx->nodes_length < ui_ctx->desc.max_node);
+  UI_Context *ctx = UI_CreateContext(&ui_node_context_desc, NULL);
+  if (ctx != NULL) {
+    ctx->images = ui_ctx->images;
+    ui_ctx->nodes[ui_ctx->nodes_length++] = (UI_NodeContext){id, ctx};
+  }
+  return ctx;
+}
+
+// Lists the nodes in tree order, skipping any without a context.
+void UI_ListNodes(UI_Node *nodes, i32 nodes_length, u32 parent_id, i32 *length) {
+  for (i32 i = 0; i < nodes_length; i++) {
+    UI_Node *node = &nodes[i];
+    u32 id = ui_hash_combine(parent_id, node->label, strlen(node->label));
+    UI_Context *ctx = UI_GetNodeContext(id);
+    if (ctx != NULL) {
+      assert(*length < ui_ctx->desc.max_node);
+      ui_ctx->node_builds[(*length)++] = (UI_NodeBuild){.node = node, .ctx = ctx, .parent = ui_ctx};
+    }
+    UI_ListNodes(node->children, node->children_length, id, length);
+  }
+}
+
+// Starts a node's frame with the parent's input, already resolved by the
+// parent, and its current layout state.
+void UI_ClearNode(UI_Context *node, UI_Context *parent, v2 pos) {
+  node->frame = parent->frame;
+  // The tweens are advanced, and the deferred subtrees planned, by the node's
+  // build.
+  node->time = parent->time;
+  node->build_budget = parent->build_budget;
+  // Built into the same slot as the parent, so the node's frame arena lasts
+  // as long as the parent's frame.
+  node->build = &node->frames[parent->build - parent->frames];
+  node->build->draw_queue.length = 0;
+  node->build->draw_queue.payloads_length = 0;
+  UI_ResetArena(&node->build->arena);
+  node->emit_culled = 0;
+  node->hover_id = parent->hover_id;
+  node->active_id = parent->active_id;
+  node->scroll_hover_id = parent->scroll_hover_id;
+  node->scroll_hover_next = 0;
+  node->input_state = parent->input_state;
+
+  node->input_events_frame = 0;
+  node->input_events_head = 0;
+  for (u32 i = parent->input_events_frame; i != parent->input_events_head; i++) {
+    node->input_events[node->input_events_head++] = parent->input_events[i % parent->desc.max_input_event];
+  }
+  node->input_events_tail = node->input_events_head;
+  assert(parent->clicks_length <= node->desc.max_input_event);
+  memcpy(node->clicks, parent->clicks, parent->clicks_length * sizeof(*parent->clicks));
+  node->clicks_length = parent->clicks_length;
+
+  node->memo_cache_length[node->frame & 1] = 0;
+  node->state_stack_length = 0;
+  node->state = node->state_chunks[0];
+  *node->state = *parent->state;
+  node->state->pos = pos;
+}
+
+void UI_BuildNode(void *data, i32 index) {
+  UI_NodeBuild *build = &((UI_NodeBuild *)data)[index];
+  UI_Context *caller = ui_ctx;
+  UI_SetContext(build->ctx);
+  UI_UpdateTweens();
+  UI_PlanDeferred();
+  UI_BeginPanel();
+  build->node->build(build->node->data);
+  UI_EndPanel();
+  UI_SetContext(caller);
+}
+
+// Copies a node's cmds into its range of the parent's draw queue.
+void UI_CopyNode(void *data, i32 index) {
+  UI_NodeBuild *build = &((UI_NodeBuild *)data)[index];
+  UI_DrawQueue *src = &build->ctx->build->draw_queue;
+  UI_DrawQueue *dst = &build->parent->build->draw_queue;
+  i32 offset = build->offset;
+  memcpy(&dst->id[offset], src->id, src->length * sizeof(*src->id));
+  memcpy(&dst->type[offset], src->type, src->length * sizeof(*src->type));
+  memcpy(&dst->x[offset], src->x, src->length * sizeof(*src->x));
+  memcpy(&dst->y[offset], src->y, src->length * sizeof(*src->y));
+  memcpy(&dst->w[offset], src->w, src->length * sizeof(*src->w));
+  memcpy(&dst->h[offset], src->h, src->length * sizeof(*src->h));
+  for (i32 i = 0; i < src->length; i++) {
+    dst->payload[offset + i] = src->payload[i] < 0 ? -1 : src->payload[i] + build->payload_offset;
+  }
+  memcpy(&dst->payloads[build->payload_offset], src->payloads, src->payloads_length * sizeof(*src->payloads));
+}
+
+// Builds a tree of nodes in parallel on pool, which may be NULL. The cmds
+// are appended in tree order, as if built one after another: each node's
+// panel and content, then its children. Nodes are placed absolutely, so they
+// don't affect the layout. Call outside of scroll regions. pool shouldn't be
+// the one running the caller, its helpers could only start once it returns.
+void UI_BuildNodes(UI_ThreadPool *pool, UI_Node *nodes, i32 nodes_length) {
+  i32 length = 0;
+  UI_ListNodes(nodes, nodes_length, UI_HASH_SEED, &length);
+  for (i32 i = 0; i < length; i++) {
+    UI_NodeBuild *build = &ui_ctx->node_builds[i];
+    UI_ClearNode(build->ctx, ui_ctx, build->node->pos);
+  }
+  UI_ParallelFor(pool, length, UI_BuildNode, ui_ctx->node_builds);
+
+  // Reserve a range of the draw queue per node, the ranges are disjoint so
+  // they're filled in parallel.
+  UI_DrawQueue *queue = &ui_ctx->build->draw_queue;
+  for (i32 i = 0; i < length; i++) {
+    UI_NodeBuild *build = &ui_ctx->node_builds[i];
+    UI_DrawQueue *node_queue = &build->ctx->build->draw_queue;
+    build->offset = queue->length;
+    build->payload_offset = queue->payloads_length;
+    queue->length += node_queue->length;
+    queue->payloads_length += node_queue->payloads_length;
+    if (!UI_ReserveDrawQueue(queue, queue->length)) {
+      // Out of memory.
+      assert(false);
+    }
+    ui_ctx->emit_culled += build->ctx->emit_culled;
+    ui_ctx->deferred_replayed += build->ctx->deferred_replayed;
+    UI_Tweens *tweens = &build->ctx->tweens;
+    if (tweens->running > 0 &&
+        (ui_ctx->tweens.running == 0 || (i32)(tweens->until - ui_ctx->tweens.until) > 0)) {
+      ui_ctx->tweens.until = tweens->until;
+    }
+    ui_ctx->tweens.running += tweens->running;
+    ui_ctx->tweens.touched += tweens->touched;
+    if (ui_ctx->scroll_hover_next == 0) {
+      ui_ctx->scroll_hover_next = build->ctx->scroll_hover_next;
+    }
+  }
+  UI_ParallelFor(pool, length, UI_CopyNode, ui_ctx->node_builds);
+}
+
+// END UI Nodes
+
+// UI Images
+
+// Makes pool decode the context's images.
+void UI_SetImageDecoder(UI_ThreadPool *pool) {
+  ui_ctx->images->pool = pool;
+}
+
+// Returns the cache's entry for the image, adding it if new, or the cache's
+// placeholder once every slot is taken. Safe to call from several threads at
+// once, node contexts build into their parent's cache.
+UI_ImageEntry *UI_GetImageEntry(UI_ImageCache *cache, const char *path, i32 w, i32 h) {
+  u32 id = ui_hash(path, strlen(path));
+  id = ui_hash_combine(id, &w, sizeof(w));
+  id = ui_hash_combine(id, &h, sizeof(h));
+  for (i32 i = 0; i < cache->capacity; i++) {
+    UI_ImageEntry *image = &cache->entries[(id + i) % cache->capacity];
+    if (SDL_AtomicCAS(&image->state, UI_IMAGE_EMPTY, UI_IMAGE_CLAIMED)) {
+      image->cache = cache;
+      image->id = id;
+      image->path = SDL_strdup(path);
+      image->w = w;
+      image->h = h;
+      image->page = -1;
+      SDL_AtomicSet(&image->state, image->path ? UI_IMAGE_UNLOADED : UI_IMAGE_FAILED);
+      return image;
+    }
+    while (SDL_AtomicGet(&image->state) == UI_IMAGE_CLAIMED) {
+      SDL_CPUPauseInstruction();
+    }
+    // Without a path, out of memory, it can only match on the hash.
+    if (image->id == id && image->w == w && image->h == h &&
+        (image->path == NULL || strcmp(image->path, path) == 0)) {
+      return image;
+    }
+  }
+
+  return &cache->full;
+}
+
+// Returns NULL if out of memory. Each pixel of the level averages 4 source
+// pixels spread across the block it covers, rather than the whole block, so
+// every level decodes in the same time.
+SDL_Surface *UI_DecodeTile(UI_ImageEntry *image) {
+  const UI_TileSource *source = image->source;
+  SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, image->w, image->h, 32, SDL_PIXELFORMAT_ARGB8888);
+  if (surface == NULL) {
+    return NULL;
+  }
+  i32 step = 1 << image->level;
+  for (i32 y = 0; y < image->h; y++) {
+    u32 *row = (u32 *)((u8 *)surface->pixels + y * surface->pitch);
+    i32 y0 = (image->tile.y + y) * step;
+    i32 y1 = SDL_min(y0 + step / 2, source->height - 1);
+    const u32 *src0 = source->pixels + (size_t)y0 * source->width;
+    const u32 *src1 = source->pixels + (size_t)y1 * source->width;
+    for (i32 x = 0; x < image->w; x++) {
+      i32 x0 = (image->tile.x + x) * step;
+      i32 x1 = SDL_min(x0 + step / 2, source->width - 1);
+      u32 p[4] = {src0[x0], src0[x1], src1[x0], src1[x1]};
+      // Two channels at a time, with room between them for the carry.
+      u32 rb = 0;
+      u32 ag = 0;
+      for (i32 i = 0; i < 4; i++) {
+        rb += p[i] & 0x00ff00ff;
+        ag += (p[i] >> 8) & 0x00ff00ff;
+      }
+      row[x] = ((rb >> 2) & 0x00ff00ff) | ((ag >> 2) & 0x00ff00ff) << 8;
+    }
+  }
+  return surface;
+}
+
+// Runs on a decoder. Images larger than drawn are scaled down here, so the
+// texture is no larger than needed.
+void UI_DecodeImage(void *data) {
+  UI_ImageEntry *image = data;
+  if (image->source != NULL) {
+    SDL_Surface *surface = UI_DecodeTile(image);
+    image->surface = surface;
+    SDL_AtomicAdd(&image->cache->decoding, -1);
+    SDL_AtomicSet(&image->state, surface ? UI_IMAGE_DECODED : UI_IMAGE_FAILED);
+    UI_RequestFrame();
+    return;
+  }
+
+  SDL_Surface *surface = IMG_Load(image->path);
+  if (surface != NULL) {
+    SDL_Surface *converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(surface);
+    surface = converted;
+  }
+  if (surface != NULL && surface->w * surface->h > image->w * image->h) {
+    SDL_Surface *scaled = SDL_CreateRGBSurfaceWithFormat(0, image->w, image->h, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (scaled != NULL) {
+      SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+      SDL_BlitScaled(surface, NULL, scaled, NULL);
+    }
+    SDL_FreeSurface(surface);
+    surface = scaled;
+  }
+  if (surface == NULL) {
+    printf("[Image]: %s: %s\n", image->path, SDL_GetError());
+  }
+
+  image->surface = surface;
+  SDL_AtomicAdd(&image->cache->decoding, -1);
+  SDL_AtomicSet(&image->state, surface ? UI_IMAGE_DECODED : UI_IMAGE_FAILED);
+  UI_RequestFrame();
+}
+
+// Starts decoding the image if it isn't loaded. Past the limit the request
+// waits for a later frame, so opening a large gallery doesn't flood the
+// decoders.
+void UI_RequestImage(UI_ImageEntry *image) {
+  UI_ImageCache *cache = image->cache;
+  if (cache->pool != NULL && SDL_AtomicGet(&cache->decoding) < UI_MAX_IMAGE_DECODE &&
+      SDL_AtomicCAS(&image->state, UI_IMAGE_UNLOADED, UI_IMAGE_DECODING)) {
+    SDL_AtomicAdd(&cache->decoding, 1);
+    UI_SubmitJob(cache->pool, UI_DecodeImage, image);
+  }
+}
+
+// Draws the image at path, scaled to w by h. It's decoded in the background,
+// and a placeholder is drawn until it's loaded.
+void UI_Image(const char *path, i32 w, i32 h) {
+  Rect rect = {ui->pos.x, ui->pos.y, w, h};
+  UI_UpdateLayout(&rect);
+  // Culled images aren't requested, so only what's in view is decoded.
+  if (UI_Cull(&rect)) {
+    return;
+  }
+
+  UI_ImageEntry *image = UI_GetImageEntry(ui_ctx->images, path, w, h);
+  UI_RequestImage(image);
+
+  i32 index = UI_PushDrawCmd(UI_IMAGE, 0, rect);
+  UI_SetDrawCmdPayload(index, (UI_DrawPayload){.image = image});
+}
+
+// UI_Image() with a path formatted into the frame arena.
+void UI_Imagef(i32 w, i32 h, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  const char *path = UI_FrameFormatV(format, args);
+  va_end(args);
+  UI_Image(path, w, h);
+}
+
+// Maps a raw image of width by height ARGB8888 pixels, row major with no
+// padding, e.g. as written by ImageMagick's "convert in.png BGRA:out.raw" on
+// a little endian machine. Returns NULL on failure. Nothing is read until
+// tiles are decoded, so it opens instantly however large it is.
+UI_TileSource *UI_OpenRawImage(const char *path, i32 width, i32 height) {
+  if (width <= 0 || height <= 0) {
+    SDL_SetError("%s: invalid size %dx%d", path, width, height);
+    return NULL;
+  }
+  i32 fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    SDL_SetError("%s: %s", path, strerror(errno));
+    return NULL;
+  }
+  struct stat st;
+  size_t size = (size_t)width * height * sizeof(u32);
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < size) {
+    SDL_SetError("%s: smaller than %dx%d", path, width, height);
+    close(fd);
+    return NULL;
+  }
+  void *pixels = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (pixels == MAP_FAILED) {
+    SDL_SetError("%s: %s", path, strerror(errno));
+    return NULL;
+  }
+  UI_TileSource *source = UI_Calloc(1, sizeof(UI_TileSource));
+  if (source == NULL) {
+    munmap(pixels, size);
+    SDL_OutOfMemory();
+    return NULL;
+  }
+
+  source->width = width;
+  source->height = height;
+  source->pixels = pixels;
+  source->size = size;
+  for (i32 level = 0; level < UI_MAX_TILE_LEVEL; level++) {
+    i32 step = 1 << level;
+    i32 level_w = (width + step - 1) / step;
+    i32 level_h = (height + step - 1) / step;
+    source->columns[level] = (level_w + UI_TILE_SIZE - 1) / UI_TILE_SIZE;
+    source->rows[level] = (level_h + UI_TILE_SIZE - 1) / UI_TILE_SIZE;
+    source->level_tiles[level + 1] = source->level_tiles[level] + source->columns[level] * source->rows[level];
+    source->levels = level + 1;
+    if (level_w <= UI_TILE_SIZE && level_h <= UI_TILE_SIZE) {
+      break;
+    }
+  }
+  return source;
+}
+
+// Call once the contexts that drew it are destroyed.
+void UI_CloseRawImage(UI_TileSource *source) {
+  if (source != NULL) {
+    munmap((void *)source->pixels, source->size);
+    SDL_free(source);
+  }
+}
+
+// Returns the cache's tiles of source, adding them when it's first drawn.
+// Returns NULL if out of memory, or there are too many sources.
+UI_TileSet *UI_GetTileSet(UI_ImageCache *cache, const UI_TileSource *source) {
+  for (i32 i = 0; i < SDL_AtomicGet(&cache->tile_sets_length); i++) {
+    if (cache->tile_sets[i].source == source) {
+      return &cache->tile_sets[i];
+    }
+  }
+
+  // Node contexts build into the same cache, so check again once locked.
+  SDL_AtomicLock(&cache->tile_sets_lock);
+  i32 length = SDL_AtomicGet(&cache->tile_sets_length);
+  UI_TileSet *set = NULL;
+  for (i32 i = 0; i < length && set == NULL; i++) {
+    if (cache->tile_sets[i].source == source) {
+      set = &cache->tile_sets[i];
+    }
+  }
+  UI_ImageEntry *tiles = NULL;
+  if (set == NULL && length < UI_MAX_TILE_SOURCE) {
+    tiles = UI_Calloc(source->level_tiles[source->levels], sizeof(UI_ImageEntry));
+  }
+  if (tiles != NULL) {
+    for (i32 level = 0; level < source->levels; level++) {
+      i32 step = 1 << level;
+      i32 level_w = (source->width + step - 1) / step;
+      i32 level_h = (source->height + step - 1) / step;
+      for (i32 i = 0; i < source->columns[level] * source->rows[level]; i++) {
+        UI_ImageEntry *tile = &tiles[source->level_tiles[level] + i];
+        tile->cache = cache;
+        tile->source = source;
+        tile->level = level;
+        tile->tile = (v2){i % source->columns[level] * UI_TILE_SIZE, i / source->columns[level] * UI_TILE_SIZE};
+        tile->w = SDL_min(UI_TILE_SIZE, level_w - tile->tile.x);
+        tile->h = SDL_min(UI_TILE_SIZE, level_h - tile->tile.y);
+        tile->page = -1;
+        SDL_AtomicSet(&tile->state, UI_IMAGE_UNLOADED);
+      }
+    }
+    set = &cache->tile_sets[length];
+    *set = (UI_TileSet){source, tiles};
+    // Publishes the tiles to the renderer.
+    SDL_AtomicSet(&cache->tile_sets_length, length + 1);
+  }
+  SDL_AtomicUnlock(&cache->tile_sets_lock);
+  return set;
+}
+
+// A w by h view of source. The wheel zooms about the pointer, and dragging
+// pans. Only the tiles in view are drawn, from the level nearest the zoom, so
+// the cost of a frame doesn't depend on the size of the image. Panning only
+// moves the viewport, so the render cache shifts the last frame's pixels and
+// draws just the exposed tiles.
+void UI_TiledImage(const char *label, const UI_TileSource *source, i32 w, i32 h) {
+  u32 id = ui_hash(label, strlen(label));
+  UI_Data *data = ui_get_data(id);
+  Rect viewport = {ui->pos.x, ui->pos.y, w, h};
+  UI_InputState *input = &ui_ctx->input_state;
+
+  // Zoomed out as far as the whole image fitting.
+  f32 fit = SDL_min((f32)w / source->width, (f32)h / source->height);
+  f32 min_scale = SDL_min(fit, 1.0f);
+  if (data->tiled.scale == 0) {
+    data->tiled.scale = min_scale;
+  }
+  if (id == ui_ctx->scroll_hover_id && input->mouse_wheel.y != 0) {
+    f32 scale = data->tiled.scale * SDL_powf(UI_TILED_ZOOM_STEP, input->mouse_wheel.y);
+    scale = SDL_clamp(scale, min_scale, UI_TILED_MAX_SCALE);
+    // Keep the source pixel under the pointer in place.
+    f32 zoom = scale / data->tiled.scale;
+    v2 pointer = {input->mouse_pos.x - viewport.x, input->mouse_pos.y - viewport.y};
+    data->tiled.offset.x = SDL_lroundf((data->tiled.offset.x + pointer.x) * zoom - pointer.x);
+    data->tiled.offset.y = SDL_lroundf((data->tiled.offset.y + pointer.y) * zoom - pointer.y);
+    data->tiled.scale = scale;
+  }
+  if (!data->tiled.dragging && UI_InputEventInRect(UI_INPUT_MOUSE_DOWN, &viewport)) {
+    data->tiled.dragging = true;
+    data->tiled.drag_pos = input->mouse_pos;
+  }
+  if (data->tiled.dragging) {
+    data->tiled.offset.x -= input->mouse_pos.x - data->tiled.drag_pos.x;
+    data->tiled.offset.y -= input->mouse_pos.y - data->tiled.drag_pos.y;
+    data->tiled.drag_pos = input->mouse_pos;
+    Rect anywhere = {UI_COORD_MIN, UI_COORD_MIN, UI_COORD_MAX - UI_COORD_MIN, UI_COORD_MAX - UI_COORD_MIN};
+    data->tiled.dragging = !UI_InputEventInRect(UI_INPUT_MOUSE_UP, &anywhere);
+  }
+
+  // Centered while smaller than the viewport.
+  f32 scale = data->tiled.scale;
+  v2 content = {SDL_lroundf(source->width * scale), SDL_lroundf(source->height * scale)};
+  v2 *offset = &data->tiled.offset;
+  offset->x = content.x < w ? (content.x - w) / 2 : SDL_clamp(offset->x, 0, content.x - w);
+  offset->y = content.y < h ? (content.y - h) / 2 : SDL_clamp(offset->y, 0, content.y - h);
+
+  i32 index = UI_PushDrawCmd(UI_CLIP, id, viewport);
+  UI_PushState();
+  ui->index = index;
+  if (!SDL_IntersectRect(&viewport, &ui->clip, &ui->clip)) {
+    ui->clip = (Rect){viewport.x, viewport.y, 0, 0};
+  }
+
+  // The coarsest level with at least one pixel per drawn pixel.
+  i32 level = 0;
+  while (level + 1 < source->levels && scale * (2 << level) <= 1.0f) {
+    level++;
+  }
+  UI_TileSet *set = UI_GetTileSet(ui_ctx->images, source);
+  // Source pixels per tile, and drawn pixels per source pixel.
+  i32 span = UI_TILE_SIZE << level;
+  i32 column0 = SDL_max(0, (i32)(offset->x / (span * scale)));
+  i32 row0 = SDL_max(0, (i32)(offset->y / (span * scale)));
+  i32 column1 = SDL_min(source->columns[level] - 1, (i32)((offset->x + w - 1) / (span * scale)));
+  i32 row1 = SDL_min(source->rows[level] - 1, (i32)((offset->y + h - 1) / (span * scale)));
+  for (i32 row = row0; row <= row1 && set != NULL; row++) {
+    for (i32 column = column0; column <= column1; column++) {
+      UI_ImageEntry *tile = &set->tiles[source->level_tiles[level] + row * source->columns[level] + column];
+      // Both edges are rounded the same way, so neighbouring tiles meet.
+      i32 x0 = SDL_lroundf(column * span * scale);
+      i32 y0 = SDL_lroundf(row * span * scale);
+      i32 x1 = SDL_lroundf(SDL_min(column * span + (tile->w << level), source->width) * scale);
+      i32 y1 = SDL_lroundf(SDL_min(row * span + (tile->h << level), source->height) * scale);
+      Rect rect = {viewport.x - offset->x + x0, viewport.y - offset->y + y0, x1 - x0, y1 - y0};
+      if (UI_Cull(&rect)) {
+        continue;
+      }
+      UI_RequestImage(tile);
+      i32 tile_index = UI_PushDrawCmd(UI_IMAGE, 0, rect);
+      UI_SetDrawCmdPayload(tile_index, (UI_DrawPayload){.image = tile});
+    }
+  }
+
+  if (ui_ctx->scroll_hover_next == 0 && UI_MouseInRect(&ui->clip)) {
+    ui_ctx->scroll_hover_next = id;
+  }
+  Rect bounds = {viewport.x - offset->x, viewport.y - offset->y, content.x, content.y};
+  i32 unclip = UI_PushDrawCmd(UI_UNCLIP, id, bounds);
+  UI_SetDrawCmdPayload(unclip, (UI_DrawPayload){.offset = *offset});
+  UI_PopState();
+  UI_UpdateLayout(&viewport);
+}
+
+// Returns NULL on failure. Drawn by label with UI_StreamImage(), the texture
+// is created by the renderer when it's first drawn.
+UI_Stream *UI_CreateStream(UI_Context *ctx, const char *label, i32 w, i32 h) {
+  UI_ImageCache *cache = ctx->images;
+  i32 index = SDL_AtomicAdd(&cache->streams_length, 1);
+  if (index >= UI_MAX_STREAM) {
+    SDL_SetError("Out of streams");
+    return NULL;
+  }
+  UI_Stream *stream = UI_Calloc(1, sizeof(UI_Stream));
+  u32 *pixels = UI_Calloc((size_t)w * h, sizeof(u32));
+  if (stream == NULL || pixels == NULL) {
+    SDL_free(stream);
+    SDL_free(pixels);
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  stream->image.cache = cache;
+  stream->image.id = ui_hash(label, strlen(label));
+  stream->image.w = w;
+  stream->image.h = h;
+  stream->image.page = -1;
+  SDL_AtomicSet(&stream->image.state, UI_IMAGE_UNLOADED);
+  stream->pixels = pixels;
+  stream->pitch = w * sizeof(u32);
+  stream->dirty[stream->dirty_length++] = (Rect){0, 0, w, h};
+  SDL_AtomicSetPtr((void **)&cache->streams[index], stream);
+  return stream;
+}
+
+// Returns where to write the pixels of rect, rows are pitch bytes apart.
+// rect is clipped to the stream first, and is empty if it was fully outside.
+// Only rect is uploaded, once unlocked. Keep it locked briefly, the renderer
+// waits for it.
+u32 *UI_LockStream(UI_Stream *stream, Rect *rect, i32 *pitch) {
+  Rect bounds = {0, 0, stream->image.w, stream->image.h};
+  SDL_AtomicLock(&stream->lock);
+  if (!SDL_IntersectRect(rect, &bounds, rect)) {
+    *rect = (Rect){0, 0, 0, 0};
+  } else {
+    // Overlapping rects are merged, and when out of rects all of them.
+    i32 i = 0;
+    while (i < stream->dirty_length && !SDL_HasIntersection(rect, &stream->dirty[i])) {
+      i++;
+    }
+    if (i == stream->dirty_length && i == UI_MAX_STREAM_DIRTY) {
+      for (i = 1; i < stream->dirty_length; i++) {
+        SDL_UnionRect(&stream->dirty[0], &stream->dirty[i], &stream->dirty[0]);
+      }
+      stream->dirty_length = 1;
+      i = 0;
+    }
+    if (i < stream->dirty_length) {
+      SDL_UnionRect(&stream->dirty[i], rect, &stream->dirty[i]);
+    } else {
+      stream->dirty[stream->dirty_length++] = *rect;
+    }
+  }
+  stream->stats.frames++;
+  *pitch = stream->pitch;
+  return stream->pixels + rect->y * stream->image.w + rect->x;
+}
+
+void UI_UnlockStream(UI_Stream *stream) {
+  SDL_AtomicUnlock(&stream->lock);
+  UI_RequestFrame();
+}
+
+// Copies a frame the producer has already decoded into rect. Only the part of
+// rect inside the stream is copied.
+void UI_UpdateStream(UI_Stream *stream, Rect rect, const void *pixels, i32 pitch) {
+  i32 dst_pitch;
+  Rect clipped = rect;
+  u8 *dst = (u8 *)UI_LockStream(stream, &clipped, &dst_pitch);
+  const u8 *src = (const u8 *)pixels + (clipped.y - rect.y) * pitch + (clipped.x - rect.x) * sizeof(u32);
+  for (i32 y = 0; y < clipped.h; y++) {
+    memcpy(dst + y * dst_pitch, src + y * pitch, clipped.w * sizeof(u32));
+  }
+  stream->stats.copies++;
+  UI_UnlockStream(stream);
+}
+
+// Returns the counts so far.
+UI_StreamStats UI_GetStreamStats(UI_Stream *stream) {
+  SDL_AtomicLock(&stream->lock);
+  UI_StreamStats stats = stream->stats;
+  SDL_AtomicUnlock(&stream->lock);
+  return stats;
+}
+
+// Returns the current context's stream created with label, or NULL.
+UI_Stream *UI_FindStream(const char *label) {
+  UI_ImageCache *cache = ui_ctx->images;
+  u32 id = ui_hash(label, strlen(label));
+  for (i32 i = 0; i < SDL_min(SDL_AtomicGet(&cache->streams_length), UI_MAX_STREAM); i++) {
+    UI_Stream *stream = SDL_AtomicGetPtr((void **)&cache->streams[i]);
+    if (stream != NULL && stream->image.id == id) {
+      return stream;
+    }
+  }
+  return NULL;
+}
+
+// Draws the latest pixels of the stream created with label, scaled to w by
+// h. Nothing is drawn if there's no such stream.
+void UI_StreamImage(const char *label, i32 w, i32 h) {
+  Rect rect = {ui->pos.x, ui->pos.y, w, h};
+  UI_UpdateLayout(&rect);
+  UI_Stream *stream = UI_FindStream(label);
+  if (stream == NULL || UI_Cull(&rect)) {
+    return;
+  }
+  i32 index = UI_PushDrawCmd(UI_IMAGE, 0, rect);
+  UI_SetDrawCmdPayload(index, (UI_DrawPayload){.image = &stream->image});
+}
+
+// Copies the dirty rects straight into the locked texture, so each changed
+// pixel is copied once between the producer and the renderer.
+void UI_UploadStream(UI_Stream *stream) {
+  UI_ImageEntry *image = &stream->image;
+  if (image->texture == NULL) {
+    image->texture = SDL_CreateTexture(ui_ctx->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                       image->w, image->h);
+    if (image->texture == NULL) {
+      printf("[Stream]: %s\n", SDL_GetError());
+      SDL_AtomicSet(&image->state, UI_IMAGE_FAILED);
+      return;
+    }
+    SDL_SetTextureBlendMode(image->texture, SDL_BLENDMODE_BLEND);
+    SDL_AtomicSet(&image->state, UI_IMAGE_LOADED);
+  }
+
+  SDL_AtomicLock(&stream->lock);
+  for (i32 i = 0; i < stream->dirty_length; i++) {
+    Rect *rect = &stream->dirty[i];
+    u8 *dst;
+    i32 pitch;
+    if (SDL_LockTexture(image->texture, rect, (void **)&dst, &pitch) < 0) {
+      continue;
+    }
+    const u8 *src = (const u8 *)(stream->pixels + rect->y * image->w + rect->x);
+    for (i32 y = 0; y < rect->h; y++) {
+      memcpy(dst + y * pitch, src + y * stream->pitch, rect->w * sizeof(u32));
+    }
+    SDL_UnlockTexture(image->texture);
+    stream->stats.uploads++;
+    stream->stats.bytes += rect->w * rect->h * sizeof(u32);
+  }
+  if (stream->dirty_length > 0) {
+    stream->dirty_length = 0;
+    image->version++;
+  }
+  SDL_AtomicUnlock(&stream->lock);
+}
+
+// Returns NULL on failure.
+SDL_Texture *UI_CreateAtlasTexture() {
+  SDL_Texture *texture = SDL_CreateTexture(ui_ctx->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                                           UI_ATLAS_PAGE_SIZE, UI_ATLAS_PAGE_SIZE);
+  if (texture == NULL) {
+    return NULL;
+  }
+  SDL_Texture *target = SDL_GetRenderTarget(ui_ctx->renderer);
+  SDL_SetRenderTarget(ui_ctx->renderer, texture);
+  SDL_SetRenderDrawColor(ui_ctx->renderer, 0, 0, 0, 0);
+  SDL_RenderClear(ui_ctx->renderer);
+  SDL_SetRenderTarget(ui_ctx->renderer, target);
+  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  return texture;
+}
+
+// Images are padded, so filtering doesn't bleed in their neighbours.
+bool UI_PackAtlasImage(UI_AtlasPage *page, i32 w, i32 h, Rect *src) {
+  stbrp_rect rect = {.w = w + 1, .h = h + 1};
+  if (!stbrp_pack_rects(&page->packer, &rect, 1)) {
+    return false;
+  }
+  *src = (Rect){rect.x, rect.y, w, h};
+  page->used += rect.w * rect.h;
+  return true;
+}
+
+// Copies the images in entries that are on page index into the rebuilt
+// page, with the render target set to its new texture.
+void UI_RepackAtlasImages(UI_ImageEntry *entries, i32 count, i32 index) {
+  UI_ImageCache *cache = ui_ctx->images;
+  UI_AtlasPage *page = &cache->pages[index];
+  for (i32 i = 0; i < count; i++) {
+    UI_ImageEntry *image = &entries[i];
+    if (SDL_AtomicGet(&image->state) != UI_IMAGE_LOADED || image->page != index) {
+      continue;
+    }
+    Rect src;
+    if (UI_PackAtlasImage(page, image->src.w, image->src.h, &src)) {
+      SDL_RenderCopy(ui_ctx->renderer, page->texture, &image->src, &src);
+      image->src = src;
+    } else {
+      // Packed in a different order, it may not all fit again.
+      cache->bytes -= image->bytes;
+      image->bytes = 0;
+      image->page = -1;
+      SDL_AtomicSet(&image->state, UI_IMAGE_UNLOADED);
+    }
+  }
+}
+
+// Repacks the live images of a page into a new texture, closing the holes
+// left by evicted ones. Returns false if no texture could be created.
+bool UI_DefragmentAtlasPage(i32 index) {
+  UI_ImageCache *cache = ui_ctx->images;
+  UI_AtlasPage *page = &cache->pages[index];
+  SDL_Texture *texture = UI_CreateAtlasTexture();
+  if (texture == NULL) {
+    return false;
+  }
+
+  stbrp_init_target(&page->packer, UI_ATLAS_PAGE_SIZE, UI_ATLAS_PAGE_SIZE, page->nodes, UI_ATLAS_PAGE_SIZE);
+  page->used = 0;
+  SDL_Texture *target = SDL_GetRenderTarget(ui_ctx->renderer);
+  SDL_SetRenderTarget(ui_ctx->renderer, texture);
+  SDL_SetTextureBlendMode(page->texture, SDL_BLENDMODE_NONE);
+  // Small tiles are packed alongside the images.
+  UI_RepackAtlasImages(cache->entries, cache->capacity, index);
+  for (i32 i = 0; i < SDL_AtomicGet(&cache->tile_sets_length); i++) {
+    UI_TileSet *set = &cache->tile_sets[i];
+    UI_RepackAtlasImages(set->tiles, set->source->level_tiles[set->source->levels], index);
+  }
+  SDL_SetRenderTarget(ui_ctx->renderer, target);
+  SDL_DestroyTexture(page->texture);
+  page->texture = texture;
+  return true;
+}
+
+// Packs a small image into an atlas page, so consecutive images are drawn
+// together. Defragments a sparse page, or adds one, when none has room.
+// Returns false if it isn't packed, the image then gets its own texture.
+bool UI_InsertAtlasImage(UI_ImageEntry *image, SDL_Surface *surface) {
+  UI_ImageCache *cache = ui_ctx->images;
+  if (surface->w > UI_ATLAS_MAX_IMAGE || surface->h > UI_ATLAS_MAX_IMAGE ||
+      !SDL_RenderTargetSupported(ui_ctx->renderer)) {
+    return false;
+  }
+
+  i32 page = -1;
+  Rect src;
+  for (i32 i = 0; i < cache->pages_length && page < 0; i++) {
+    if (UI_PackAtlasImage(&cache->pages[i], surface->w, surface->h, &src)) {
+      page = i;
+    }
+  }
+  for (i32 i = 0; i < cache->pages_length && page < 0; i++) {
+    if (cache->pages[i].used < UI_ATLAS_PAGE_SIZE * UI_ATLAS_PAGE_SIZE / 2 && UI_DefragmentAtlasPage(i) &&
+        UI_PackAtlasImage(&cache->pages[i], surface->w, surface->h, &src)) {
+      page = i;
+    }
+  }
+  if (page < 0 && cache->pages_length < UI_MAX_ATLAS_PAGE) {
+    UI_AtlasPage *new_page = &cache->pages[cache->pages_length];
+    new_page->texture = UI_CreateAtlasTexture();
+    if (new_page->texture == NULL) {
+      return false;
+    }
+    stbrp_init_target(&new_page->packer, UI_ATLAS_PAGE_SIZE, UI_ATLAS_PAGE_SIZE, new_page->nodes, UI_ATLAS_PAGE_SIZE);
+    new_page->used = 0;
+    if (UI_PackAtlasImage(new_page, surface->w, surface->h, &src)) {
+      page = cache->pages_length;
+    }
+    cache->pages_length++;
+  }
+  if (page < 0) {
+    return false;
+  }
+
+  SDL_UpdateTexture(cache->pages[page].texture, &src, surface->pixels, surface->pitch);
+  image->page = page;
+  image->src = src;
+  return true;
+}
+
+// Returns false if the budget for this frame is spent.
+bool UI_UploadImage(UI_ImageEntry *image, i32 *uploaded) {
+  if (*uploaded >= UI_IMAGE_UPLOAD_BYTES) {
+    return false;
+  }
+  SDL_Surface *surface = image->surface;
+  image->surface = NULL;
+  image->page = -1;
+  image->texture = NULL;
+  if (!UI_InsertAtlasImage(image, surface)) {
+    image->texture = SDL_CreateTextureFromSurface(ui_ctx->renderer, surface);
+  }
+  image->bytes = surface->w * surface->h * 4;
+  SDL_FreeSurface(surface);
+  if (image->texture == NULL && image->page < 0) {
+    printf("[Image]: %s: %s\n", image->path ? image->path : "tile", SDL_GetError());
+    SDL_AtomicSet(&image->state, UI_IMAGE_FAILED);
+    return true;
+  }
+  ui_ctx->images->bytes += image->bytes;
+  *uploaded += image->bytes;
+  SDL_AtomicSet(&image->state, UI_IMAGE_LOADED);
+  return true;
+}
+
+// Uploads the decoded images in entries. Returns false if the budget for this
+// frame is spent.
+bool UI_UploadImages(UI_ImageEntry *entries, i32 count, i32 *uploaded) {
+  for (i32 i = 0; i < count; i++) {
+    UI_ImageEntry *image = &entries[i];
+    if (SDL_AtomicGet(&image->state) == UI_IMAGE_DECODED && !UI_UploadImage(image, uploaded)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the least recently rendered loaded image in entries not rendered in
+// frame, or oldest if it's older.
+UI_ImageEntry *UI_FindOldestImage(UI_ImageEntry *entries, i32 count, u32 frame, UI_ImageEntry *oldest) {
+  for (i32 i = 0; i < count; i++) {
+    UI_ImageEntry *image = &entries[i];
+    if (SDL_AtomicGet(&image->state) == UI_IMAGE_LOADED && image->rendered != frame &&
+        (oldest == NULL || image->rendered < oldest->rendered)) {
+      oldest = image;
+    }
+  }
+  return oldest;
+}
+
+// Runs on the rendering thread before each frame. Marks the frame's images as
+// used, uploads the frame's streams, and decoded images within the per frame
+// budget, the frame's own first, and evicts the least recently rendered
+// textures over the cache's byte budget. Images in the frame are never
+// evicted.
+void UI_UpdateImages() {
+  UI_ImageCache *cache = ui_ctx->images;
+  UI_Frame *frame = ui_ctx->render;
+  UI_DrawQueue *queue = &frame->draw_queue;
+  i32 uploaded = 0;
+  for (i32 i = 0; i < queue->length; i++) {
+    if (queue->type[i] != UI_IMAGE) {
+      continue;
+    }
+    UI_ImageEntry *image = queue->payloads[queue->payload[i]].image;
+    image->rendered = frame->frame;
+    if (SDL_AtomicGet(&image->state) == UI_IMAGE_DECODED) {
+      UI_UploadImage(image, &uploaded);
+    }
+  }
+  // Streams are live, so outside the budget, and only uploaded while drawn.
+  for (i32 i = 0; i < SDL_min(SDL_AtomicGet(&cache->streams_length), UI_MAX_STREAM); i++) {
+    UI_Stream *stream = SDL_AtomicGetPtr((void **)&cache->streams[i]);
+    if (stream != NULL && stream->image.rendered == frame->frame) {
+      UI_UploadStream(stream);
+    }
+  }
+  i32 tile_sets_length = SDL_AtomicGet(&cache->tile_sets_length);
+  bool uploading = UI_UploadImages(cache->entries, cache->capacity, &uploaded);
+  for (i32 i = 0; i < tile_sets_length && uploading; i++) {
+    UI_TileSet *set = &cache->tile_sets[i];
+    uploading = UI_UploadImages(set->tiles, set->source->level_tiles[set->source->levels], &uploaded);
+  }
+
+  while (cache->bytes > ui_ctx->desc.max_image_bytes) {
+    UI_ImageEntry *oldest = UI_FindOldestImage(cache->entries, cache->capacity, frame->frame, NULL);
+    for (i32 i = 0; i < tile_sets_length; i++) {
+      UI_TileSet *set = &cache->tile_sets[i];
+      oldest = UI_FindOldestImage(set->tiles, set->source->level_tiles[set->source->levels], frame->frame, oldest);
+    }
+    if (oldest == NULL) {
+      break;
+    }
+    if (oldest->page >= 0) {
+      UI_AtlasPage *page = &cache->pages[oldest->page];
+      page->used -= (oldest->src.w + 1) * (oldest->src.h + 1);
+      oldest->page = -1;
+    }
+    SDL_DestroyTexture(oldest->texture);
+    oldest->texture = NULL;
+    cache->bytes -= oldest->bytes;
+    oldest->bytes = 0;
+    // Requested again by the build if it comes back into view.
+    SDL_AtomicSet(&oldest->state, UI_IMAGE_UNLOADED);
+  }
+}
+
+// END UI Images
+
+// UI Benchmark
+
+#define UI_BENCH_ITERATIONS 20000
+
+// The draw cmd layout before the queue was split into lanes.
+typedef struct {
+  u32 id;
+  UI_DrawCmdType type;
+  Rect rect;
+  void *image;
+} UI_LegacyDrawCmd;
+
+typedef struct {
+  i32 visible;
+  i32 hit;
+  Rect bounds;
+} UI_BenchResult;
+
+UI_BenchResult UI_BenchLegacy(UI_LegacyDrawCmd *cmds, i32 length, v2 point) {
+  UI_BenchResult result = {0, -1, {INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN}};
+  for (i32 i = 0; i < length; i++) {
+    Rect *r = &cmds[i].rect;
+    result.visible += (r->x < WINDOW_WIDTH) & (r->x + r->w > 0) &
+                      (r->y < WINDOW_HEIGHT) & (r->y + r->h > 0);
+  }
+  for (i32 i = 0; i < length; i++) {
+    Rect *r = &cmds[i].rect;
+    bool inside = (point.x >= r->x) & (point.x < r->x + r->w) &
+                  (point.y >= r->y) & (point.y < r->y + r->h);
+    result.hit = inside ? i : result.hit;
+  }
+  for (i32 i = 0; i < length; i++) {
+    Rect *r = &cmds[i].rect;
+    result.bounds.x = SDL_min(result.bounds.x, r->x);
+    result.bounds.y = SDL_min(result.bounds.y, r->y);
+    result.bounds.w = SDL_max(result.bounds.w, r->x + r->w);
+    result.bounds.h = SDL_max(result.bounds.h, r->y + r->h);
+  }
+  return result;
+}
+
+UI_BenchResult UI_BenchLanes(UI_DrawQueue *queue, v2 point) {
+  UI_BenchResult result = {0, -1, {INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN}};
+  for (i32 i = 0; i < queue->length; i++) {
+    result.visible += (queue->x[i] < WINDOW_WIDTH) & (queue->x[i] + queue->w[i] > 0) &
+                      (queue->y[i] < WINDOW_HEIGHT) & (queue->y[i] + queue->h[i] > 0);
+  }
+  for (i32 i = 0; i < queue->length; i++) {
+    bool inside = (point.x >= queue->x[i]) & (point.x < queue->x[i] + queue->w[i]) &
+                  (point.y >= queue->y[i]) & (point.y < queue->y[i] + queue->h[i]);
+    result.hit = inside ? i : result.hit;
+  }
+  for (i32 i = 0; i < queue->length; i++) {
+    result.bounds.x = SDL_min(result.bounds.x, queue->x[i]);
+    result.bounds.y = SDL_min(result.bounds.y, queue->y[i]);
+    result.bounds.w = SDL_max(result.bounds.w, queue->x[i] + queue->w[i]);
+    result.bounds.h = SDL_max(result.bounds.h, queue->y[i] + queue->h[i]);
+  }
+  return result;
+}
+
+// Compares the legacy array of structs against the lanes, on the passes that
+// stream over rects: culling against the window, hit testing and bounds.
+// Runs in its own headless context.
+void UI_Benchmark() {
+  UI_Context *ctx = UI_CreateContext(NULL, NULL);
+  assert(ctx != NULL);
+  UI_Context *prev = ui_ctx;
+  UI_SetContext(ctx);
+
+  i32 length = ctx->desc.max_draw_cmd;
+  UI_LegacyDrawCmd *legacy = UI_Malloc(length * sizeof(UI_LegacyDrawCmd));
+  assert(legacy != NULL);
+  v2 point = {WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2};
+
+  UI_Clear();
+  u32 seed = 1;
+  for (i32 i = 0; i < length; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    Rect rect = {(i32)(seed % (WINDOW_WIDTH * 2)) - WINDOW_WIDTH / 2,
+                 (i32)((seed >> 8) % (WINDOW_HEIGHT * 2)) - WINDOW_HEIGHT / 2,
+                 20 + (i32)((seed >> 16) % 200),
+                 20 + (i32)((seed >> 24) % 100)};
+    legacy[i] = (UI_LegacyDrawCmd){i + 1, i % 8 == 0 ? UI_BUTTON : UI_RECT, rect, NULL};
+    UI_PushDrawCmd(legacy[i].type, legacy[i].id, rect);
+  }
+
+  size_t lanes_size = sizeof(ctx->build->draw_queue.id[0]) + sizeof(ctx->build->draw_queue.type[0]) +
+                      sizeof(ctx->build->draw_queue.x[0]) + sizeof(ctx->build->draw_queue.y[0]) +
+                      sizeof(ctx->build->draw_queue.w[0]) + sizeof(ctx->build->draw_queue.h[0]) +
+                      sizeof(ctx->build->draw_queue.payload[0]);
+  printf("Memory per cmd: %zu bytes legacy, %zu bytes lanes (+%zu for cmds with a payload)\n",
+         sizeof(UI_LegacyDrawCmd), lanes_size, sizeof(UI_DrawPayload));
+
+  UI_BenchResult a, b;
+  u64 start = SDL_GetPerformanceCounter();
+  for (i32 i = 0; i < UI_BENCH_ITERATIONS; i++) {
+    a = UI_BenchLegacy(legacy, length, point);
+  }
+  f64 legacy_time = (f64)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+  start = SDL_GetPerformanceCounter();
+  for (i32 i = 0; i < UI_BENCH_ITERATIONS; i++) {
+    b = UI_BenchLanes(&ctx->build->draw_queue, point);
+  }
+  f64 lanes_time = (f64)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+  assert(memcmp(&a, &b, sizeof(a)) == 0);
+
+  f64 cmds = (f64)length * UI_BENCH_ITERATIONS;
+  printf("Cull + hit test + bounds: %.2f ns/cmd legacy, %.2f ns/cmd lanes (%.2fx)\n",
+         legacy_time * 1e9 / cmds, lanes_time * 1e9 / cmds, legacy_time / lanes_time);
+
+  SDL_free(legacy);
+  UI_SetContext(prev);
+  UI_DestroyContext(ctx);
+}
+
+// Demo
+
+// Builds the windows, NULL when replaying.
+UI_ThreadPool *pool;
+// Lays out the dashboard nodes. A window's build runs on pool, so the nodes
+// can't share it, their helpers would wait behind the build itself.
+UI_ThreadPool *layout_pool;
+// Set with --gallery, a printf pattern for the thumbnail paths, e.g.
+// "thumbs/%03d.png".
+const char *gallery = NULL;
+
+// Set with --tiled PATH WIDTHxHEIGHT, see UI_OpenRawImage().
+UI_TileSource *tiled = NULL;
+
+// Set with --budget MS, see UI_SetBuildBudget().
+f32 build_budget = 0;
+
+// Set with --software, to render without the GPU like a thin client would.
+bool software = false;
+
+#define CAMERA_WIDTH 320
+#define CAMERA_HEIGHT 200
+
+#define GALLERY_THUMBNAILS 500
+#define GALLERY_COLUMNS 4
+
+void DashboardPanel(void *data) {
+  const char *label = data;
+  UI_Rect(180, 20);
+  UI_Rect(120, 20);
+  if (UI_Button(label)) {
+    printf("%s\n", label);
+  }
+}
+
+void DashboardDetail(void *data) {
+  (void)data;
+  UI_Rect(80, 100);
+}
+
+UI_Node dashboard_details[] = {
+  {.label = "Detail", .pos = {1165, 520}, .build = DashboardDetail},
+};
+
+// Independent panels, laid out in parallel.
+UI_Node dashboard[] = {
+  {.label = "Alerts", .pos = {340, 520}, .build = DashboardPanel, .data = "Alerts#"},
+  {.label = "Traffic", .pos = {545, 520}, .build = DashboardPanel, .data = "Traffic#"},
+  {.label = "Errors", .pos = {750, 520}, .build = DashboardPanel, .data = "Errors#"},
+  {.label = "Latency", .pos = {955, 520}, .build = DashboardPanel, .data = "Latency#",
+   .children = dashboard_details, .children_length = SDL_arraysize(dashboard_details)},
+};
+
+void BuildDemo() {
+  UI_Clear();
+
+  // Static between updates, so only rebuilt when interacted with.
+  if (UI_BeginMemo(ui_hash("Main Panel", 10), 0)) {
+    UI_BeginPanel();
+      UI_BeginPanel();
+        ui->layout = UI_LAYOUT_VERTICAL;
+        UI_Rect(100, 50);
+        UI_Rect(100, 50);
+        UI_Rect(100, 50);
+      UI_EndPanel();
+      UI_BeginPanel();
+        ui->layout = UI_LAYOUT_HORIZONTAL;
+        UI_Rect(200, 50);
+        UI_Rect(200, 50);
+        UI_Rect(200, 50);
+        if(UI_Button("Ok")) {
+          printf("Ok\n");
+        }
+        // Cause button to overlap.
+        ui->pos.x -= 40;
+        if(UI_Button("Cancel")) {
+          printf("Cancel\n");
+        }
+      UI_EndPanel();
+    UI_EndPanel();
+  }
+  UI_EndMemo();
+
+
+  UI_BeginPanel();
+    UI_Rect(500, 20);
+    UI_BeginAlign(UI_ALIGN_LEFT, "Left Buttons");
+      if(UI_Button("Cancel#")) {
+        printf("Cancel\n");
+      }
+    UI_EndAlign();
+    UI_BeginAlign(UI_ALIGN_RIGHT, "Right Buttons");
+      ui->layout = UI_LAYOUT_HORIZONTAL;
+      if(UI_Button("Ok#")) {
+        printf("Ok\n");
+      }
+      if(UI_Button("Back#")) {
+        printf("Back\n");
+      }
+    UI_EndAlign();
+  UI_EndPanel();
+
+  // Only the rows inside the viewport are drawn. The rows and the gallery may
+  // refresh at a lower rate than the rest, the rows first.
+  UI_BeginScroll("Report", 300, 200);
+    if (UI_BeginDeferred(ui_hash("Report Rows", 11), 1)) {
+      for (i32 i = 0; i < 100; i++) {
+        UI_Rect(280, 20);
+      }
+    }
+    UI_EndDeferred();
+  UI_EndScroll();
+
+  UI_BuildNodes(layout_pool, dashboard, SDL_arraysize(dashboard));
+
+  if (gallery != NULL) {
+    UI_BeginScroll("Gallery", 320, 190);
+      if (UI_BeginDeferred(ui_hash("Gallery Rows", 12), 0)) {
+        for (i32 row = 0; row < GALLERY_THUMBNAILS / GALLERY_COLUMNS; row++) {
+          UI_PushState();
+          ui->layout = UI_LAYOUT_HORIZONTAL;
+          ui->bounds = (Rect){ui->pos.x, ui->pos.y, 0, 0};
+          for (i32 column = 0; column < GALLERY_COLUMNS; column++) {
+            UI_Imagef(64, 64, gallery, row * GALLERY_COLUMNS + column);
+          }
+          Rect bounds = ui->bounds;
+          UI_PopState();
+          UI_UpdateLayout(&bounds);
+        }
+      }
+      UI_EndDeferred();
+    UI_EndScroll();
+  }
+
+  UI_PushState();
+  ui->pos = (v2){540, 300};
+  UI_StreamImage("Camera", CAMERA_WIDTH, CAMERA_HEIGHT);
+  UI_PopState();
+
+  if (tiled != NULL) {
+    UI_PushState();
+    ui->pos = (v2){920, 10};
+    UI_TiledImage("Tiled", tiled, 350, 490);
+    UI_PopState();
+  }
+
+  UI_CullDrawQueue();
+  UI_BuildHitIndex();
+  UI_OccludeDrawQueue();
+}
+
+// Windows
+
+#define MAX_WINDOWS 4
+#define FRAME_MS (1000/16)
+
+// Each window has its own renderer and UI context. Its frames are built on
+// the thread pool, and rendered on the main thread, or with --render-thread
+// on a render thread that runs concurrently with the builds.
+typedef struct {
+  SDL_Window *window;
+  SDL_Renderer *renderer;
+  UI_Context *ctx;
+  u32 id;
+  bool closed;
+
+  // Input received since the last build, handed to the context before the
+  // next one, so the main thread never writes to a context being built.
+  UI_InputEvent events[UI_MAX_INPUT_EVENT];
+  i32 events_length;
+  u32 events_dropped;
+  v2 mouse_pos;
+  v2 mouse_wheel;
+
+  // Set while a worker builds the next frame.
+  SDL_atomic_t building;
+  // A built frame is waiting to be presented, without a render thread.
+  bool built;
+  bool show_latency_overlay;
+
+  // Formatted by the rendering thread, set on the window by the main thread.
+  UI_CullStats reported_stats;
+  UI_StreamStats reported_camera;
+  char title[512];
+  bool title_changed;
+  SDL_SpinLock title_lock;
+} Window;
+
+Window windows[MAX_WINDOWS];
+i32 windows_length = 0;
+// Posted by the workers whenever a frame is built.
+SDL_sem *frames_built;
+
+UI_ThreadPool *decoders;
+
+// Set with --render-thread.
+bool render_thread = false;
+SDL_Thread *render_thread_handle;
+SDL_atomic_t render_thread_quit;
+SDL_sem *renderers_created;
+
+// Toggled with F3.
+bool show_latency_overlay = false;
+
+// Set by PollInput() when any event arrived, see WaitForFrame().
+bool input_received = false;
+
+SDL_Thread *telemetry_thread;
+SDL_atomic_t telemetry_quit;
+
+SDL_Thread *camera_thread;
+SDL_atomic_t camera_quit;
+
+Window *OpenWindow(const char *title) {
+  assert(windows_length < MAX_WINDOWS);
+  Window *w = &windows[windows_length++];
+  *w = (Window){.mouse_pos = {-1, -1}, .reported_stats = {-1}};
+
+  w->window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_SHOWN);
+  if (!w->window) {
+    HandleSDLError("SDL_CreateWindow");
+  }
+  w->id = SDL_GetWindowID(w->window);
+
+  w->ctx = UI_CreateContext(NULL, NULL);
+  if (!w->ctx) {
+    HandleSDLError("UI_CreateContext");
+  }
+  return w;
+}
+
+// Call on the thread that renders the window.
+void CreateRenderer(Window *w) {
+  w->renderer = SDL_CreateRenderer(w->window, -1, software ? SDL_RENDERER_SOFTWARE : SDL_RENDERER_ACCELERATED);
+  if (!w->renderer) {
+    HandleSDLError("SDL_CreateRenderer");
+  }
+  w->ctx->renderer = w->renderer;
+
+  // Software rendering drops resolution rather than frames under load.
+  SDL_RendererInfo info;
+  if (SDL_GetRendererInfo(w->renderer, &info) == 0 && (info.flags & SDL_RENDERER_SOFTWARE)) {
+    UI_SetContext(w->ctx);
+    UI_SetDynamicResolution(FRAME_MS, true);
+  }
+}
+
+// Call on the thread that renders the window.
+void DestroyRenderer(Window *w) {
+  UI_SetContext(w->ctx);
+  UI_ReleaseRenderer();
+  SDL_DestroyRenderer(w->renderer);
+  w->renderer = NULL;
+}
+
+// Call once no build is running, and the renderers are destroyed.
+void CloseWindows() {
+  for (i32 i = 0; i < windows_length; i++) {
+    UI_SetContext(windows[i].ctx);
+    UI_HighWater *high_water = &ui_ctx->high_water;
+    printf("[Window %d]: at most %d cmds, %d states and %d aligns in a frame\n",
+           i + 1, high_water->draw_cmds, high_water->states, high_water->aligns);
+    u32 dropped = windows[i].events_dropped + ui_ctx->input_events_dropped;
+    if (dropped > 0) {
+      printf("[Window %d]: dropped %u input events\n", i + 1, dropped);
+    }
+    UI_EndRecording();
+    UI_DestroyContext(windows[i].ctx);
+    SDL_DestroyWindow(windows[i].window);
+  }
+  UI_SetContext(NULL);
+  windows_length = 0;
+}
+
+Window *FindWindow(u32 id) {
+  for (i32 i = 0; i < windows_length; i++) {
+    if (windows[i].id == id) {
+      return &windows[i];
+    }
+  }
+  return NULL;
+}
+
+// Stands in for a background producer, e.g. a telemetry decoder. Marks each
+// sample it decodes along the top of the first window, straight from its
+// own thread.
+i32 TelemetryThread(void *data) {
+  Window *w = data;
+  UI_OverlayBuffer *overlay = UI_CreateOverlayBuffer(w->ctx);
+  if (overlay == NULL) {
+    printf("[Telemetry]: %s\n", SDL_GetError());
+    return 1;
+  }
+  for (u32 sample = 0; !SDL_AtomicGet(&telemetry_quit); sample++) {
+    i32 x = (sample * 8) % WINDOW_WIDTH;
+    UI_PushOverlayFill(overlay, 0, 0, (Rect){0, 0, WINDOW_WIDTH, 4}, (UI_Color){20, 20, 20, 255});
+    UI_PushOverlayFill(overlay, 1, sample, (Rect){x, 0, 8, 4}, (UI_Color){80, 200, 120, 255});
+    UI_SubmitOverlay(overlay);
+    SDL_Delay(100);
+  }
+  return 0;
+}
+
+// Stands in for a camera capture thread. Moves a square over a still
+// background in every window's stream, so only the rects it covers and
+// uncovers are uploaded.
+i32 CameraThread(void *data) {
+  (void)data;
+  UI_Stream *streams[MAX_WINDOWS];
+  for (i32 i = 0; i < windows_length; i++) {
+    streams[i] = UI_CreateStream(windows[i].ctx, "Camera", CAMERA_WIDTH, CAMERA_HEIGHT);
+    if (streams[i] == NULL) {
+      printf("[Camera]: %s\n", SDL_GetError());
+      return 1;
+    }
+  }
+  Rect last = {0, 0, CAMERA_WIDTH, CAMERA_HEIGHT};
+  for (u32 frame = 0; !SDL_AtomicGet(&camera_quit); frame++) {
+    Rect square = {frame * 4 % (CAMERA_WIDTH - 40), CAMERA_HEIGHT / 2 - 20, 40, 40};
+    Rect dirty;
+    SDL_UnionRect(&last, &square, &dirty);
+    for (i32 i = 0; i < windows_length; i++) {
+      i32 pitch;
+      u8 *pixels = (u8 *)UI_LockStream(streams[i], &dirty, &pitch);
+      for (i32 y = 0; y < dirty.h; y++) {
+        u32 *row = (u32 *)(pixels + y * pitch);
+        for (i32 x = 0; x < dirty.w; x++) {
+          SDL_Point p = {dirty.x + x, dirty.y + y};
+          row[x] = SDL_PointInRect(&p, &square) ? 0xffe0c040 : 0xff203040 + (p.y & 0x1f);
+        }
+      }
+      UI_UnlockStream(streams[i]);
+    }
+    last = square;
+    SDL_Delay(33);
+  }
+  return 0;
+}
+
+// Keeps the window's newest events while a slow build holds them up, like
+// UI_PushInputEvent() does. Consecutive moves or wheel events are merged,
+// keeping the first's timestamp, the latency of the earliest.
+void QueueEvent(Window *w, UI_InputEvent event) {
+  if (w->events_length > 0 && (event.type == UI_INPUT_MOUSE_MOVE || event.type == UI_INPUT_MOUSE_WHEEL) &&
+      w->events[w->events_length - 1].type == event.type) {
+    w->events[w->events_length - 1].pos = event.pos;
+    return;
+  }
+  if (w->events_length == UI_MAX_INPUT_EVENT) {
+    memmove(w->events, w->events + 1, (UI_MAX_INPUT_EVENT - 1) * sizeof(*w->events));
+    w->events_length--;
+    w->events_dropped++;
+  }
+  w->events[w->events_length++] = event;
+}
+
+// Returns false when the app should quit.
+bool PollInput() {
+  SDL_Event event;
+
+  while (SDL_PollEvent(&event)) {
+    input_received = true;
+    switch (event.type) {
+      case SDL_QUIT:
+        return false;
+      case SDL_KEYDOWN: {
+        if (event.key.keysym.sym == SDLK_ESCAPE) {
+          return false;
+        }
+        if (event.key.keysym.sym == SDLK_F3) {
+          show_latency_overlay = !show_latency_overlay;
+        }
+        Window *w = FindWindow(event.key.windowID);
+        if (w != NULL) {
+          QueueEvent(w, (UI_InputEvent){.type = UI_INPUT_KEY, .pos = w->mouse_pos, .timestamp = event.key.timestamp});
+        }
+      } break;
+      case SDL_WINDOWEVENT: {
+        Window *w = FindWindow(event.window.windowID);
+        if (w == NULL) {
+          break;
+        }
+        if (event.window.event == SDL_WINDOWEVENT_LEAVE) {
+          w->mouse_pos = (v2){-1, -1};
+        } else if (event.window.event == SDL_WINDOWEVENT_CLOSE) {
+          // Destroyed on exit, its context may still be building.
+          w->closed = true;
+          SDL_HideWindow(w->window);
+        }
+      } break;
+      case SDL_MOUSEMOTION: {
+        Window *w = FindWindow(event.motion.windowID);
+        if (w != NULL) {
+          w->mouse_pos = (v2){event.motion.x, event.motion.y};
+          QueueEvent(w, (UI_InputEvent){.type = UI_INPUT_MOUSE_MOVE, .pos = w->mouse_pos, .timestamp = event.motion.timestamp});
+        }
+      } break;
+      case SDL_MOUSEBUTTONDOWN:
+      case SDL_MOUSEBUTTONUP: {
+        Window *w = FindWindow(event.button.windowID);
+        UI_MouseButton button;
+        if (w == NULL) {
+          break;
+        } else if (event.button.button == SDL_BUTTON_LEFT) {
+          button = UI_MOUSE_BUTTON_LEFT;
+        } else if (event.button.button == SDL_BUTTON_RIGHT) {
+          button = UI_MOUSE_BUTTON_RIGHT;
+        } else {
+          break;
+        }
+        QueueEvent(w, (UI_InputEvent){
+          .type = event.type == SDL_MOUSEBUTTONDOWN ? UI_INPUT_MOUSE_DOWN : UI_INPUT_MOUSE_UP,
+          .button = button,
+          .pos = {event.button.x, event.button.y},
+          .timestamp = event.button.timestamp,
+        });
+        w->mouse_pos = (v2){event.button.x, event.button.y};
+      } break;
+      case SDL_MOUSEWHEEL: {
+        Window *w = FindWindow(event.wheel.windowID);
+        if (w == NULL) {
+          break;
+        }
+        i32 sign = event.wheel.direction == SDL_MOUSEWHEEL_FLIPPED ? -1 : 1;
+        w->mouse_wheel.x += event.wheel.x * sign;
+        w->mouse_wheel.y += event.wheel.y * sign;
+        QueueEvent(w, (UI_InputEvent){.type = UI_INPUT_MOUSE_WHEEL, .pos = w->mouse_pos, .timestamp = event.wheel.timestamp});
+      } break;
+    }
+  }
+
+  for (i32 i = 0; i < windows_length; i++) {
+    if (!windows[i].closed) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Hands the input received since the last build to the window's context.
+void ApplyInput(Window *w) {
+  for (i32 i = 0; i < w->events_length; i++) {
+    UI_PushInputEvent(w->events[i]);
+  }
+  w->events_length = 0;
+  ui_ctx->input_state.mouse_pos = w->mouse_pos;
+  ui_ctx->input_state.mouse_wheel = w->mouse_wheel;
+  w->mouse_wheel = (v2){0, 0};
+  ui_ctx->sample_time = SDL_GetPerformanceCounter();
+  w->show_latency_overlay = show_latency_overlay;
+}
+
+// Runs on a worker.
+void BuildWindow(void *data) {
+  Window *w = data;
+  UI_SetContext(w->ctx);
+  BuildDemo();
+  if (ui_ctx->recording != NULL) {
+    UI_RecordFrame();
+  }
+  UI_MergeOverlays();
+  if (w->show_latency_overlay) {
+    UI_LatencyOverlay();
+  }
+  UI_EndFrame();
+  SDL_AtomicSet(&w->building, 0);
+  SDL_SemPost(frames_built);
+}
+
+// Call on the rendering thread, after presenting.
+void ReportStats(Window *w) {
+  // Report culling and latency, the latency stats change every frame so only
+  // refresh for them about once a second.
+  UI_Frame *frame = ui_ctx->render;
+  if (memcmp(&w->reported_stats, &frame->cull_stats, sizeof(UI_CullStats)) != 0 || frame->frame % 16 == 0) {
+    UI_CullStats cull_stats = w->reported_stats = frame->cull_stats;
+    UI_LatencyHistogram *presented = &ui_ctx->latency[UI_LATENCY_PRESENTED];
+    // Uploaded since the last report.
+    UI_Stream *camera = UI_FindStream("Camera");
+    UI_StreamStats camera_stats = camera ? UI_GetStreamStats(camera) : (UI_StreamStats){0};
+    u64 camera_bytes = camera_stats.bytes - w->reported_camera.bytes;
+    u32 camera_frames = camera_stats.frames - w->reported_camera.frames;
+    w->reported_camera = camera_stats;
+    SDL_AtomicLock(&w->title_lock);
+    snprintf(w->title, sizeof(w->title), "SDL Window %d - %d visible, %d culled, %d trimmed, %d occluded, %d culled at emission, %d deferred, rendered at %d%%"
+             " - event to present p50 %u ms, p95 %u ms, p99 %u ms - pointer to present %.1f ms, %.1f ms late latched"
+             " - camera %u frames, %llu KB uploaded - frame arena %zu of %zu KB peak",
+             (i32)(w - windows) + 1,
+             cull_stats.visible, cull_stats.culled, cull_stats.trimmed, cull_stats.occluded, frame->emit_culled, frame->deferred,
+             (i32)(UI_GetResolutionScale() * 100),
+             UI_LatencyPercentile(presented, 0.5f),
+             UI_LatencyPercentile(presented, 0.95f),
+             UI_LatencyPercentile(presented, 0.99f),
+             ui_ctx->latch_stats.count ? ui_ctx->latch_stats.early / ui_ctx->latch_stats.count : 0.0,
+             ui_ctx->latch_stats.count ? ui_ctx->latch_stats.late / ui_ctx->latch_stats.count : 0.0,
+             camera_frames, (unsigned long long)camera_bytes / 1024,
+             frame->arena.high_water / 1024, frame->arena.capacity / 1024);
+    w->title_changed = true;
+    SDL_AtomicUnlock(&w->title_lock);
+  }
+}
+
+void UpdateTitles() {
+  for (i32 i = 0; i < windows_length; i++) {
+    Window *w = &windows[i];
+    SDL_AtomicLock(&w->title_lock);
+    if (w->title_changed) {
+      SDL_SetWindowTitle(w->window, w->title);
+      w->title_changed = false;
+    }
+    SDL_AtomicUnlock(&w->title_lock);
+  }
+}
+
+void RenderFrame(Window *w) {
+  SDL_SetRenderDrawColor(w->renderer, 60, 80, 40, 255);
+  SDL_RenderClear(w->renderer);
+  if (!render_thread) {
+    SDL_PumpEvents();
+  }
+  UI_LateLatch();
+  UI_Render();
+  SDL_RenderPresent(w->renderer);
+  UI_FramePresented();
+  ReportStats(w);
+}
+
+// Owns the renderers, and renders each window's newest frame as soon as it's
+// built, while the next one is built.
+i32 RenderThread(void *data) {
+  (void)data;
+  for (i32 i = 0; i < windows_length; i++) {
+    CreateRenderer(&windows[i]);
+  }
+  SDL_SemPost(renderers_created);
+
+  while (!SDL_AtomicGet(&render_thread_quit)) {
+    SDL_SemWait(frames_built);
+    for (i32 i = 0; i < windows_length; i++) {
+      Window *w = &windows[i];
+      UI_SetContext(w->ctx);
+      if (UI_AcquireFrame()) {
+        RenderFrame(w);
+      }
+    }
+  }
+
+  for (i32 i = 0; i < windows_length; i++) {
+    DestroyRenderer(&windows[i]);
+  }
+  return 0;
+}
+
+// Starts building the next frame of every window that isn't still building,
+// or waiting to present the last one on the main thread.
+void StartBuilds() {
+  for (i32 i = 0; i < windows_length; i++) {
+    Window *w = &windows[i];
+    if (w->closed || (w->built && !render_thread) || SDL_AtomicGet(&w->building)) {
+      continue;
+    }
+    UI_SetContext(w->ctx);
+    ApplyInput(w);
+    w->built = true;
+    SDL_AtomicSet(&w->building, 1);
+    UI_SubmitJob(pool, BuildWindow, w);
+  }
+}
+
+// Presents every window whose build has finished. Returns the number of
+// windows still building.
+i32 PresentBuilt() {
+  i32 building = 0;
+  for (i32 i = 0; i < windows_length; i++) {
+    Window *w = &windows[i];
+    if (w->closed || !w->built) {
+      continue;
+    }
+    if (SDL_AtomicGet(&w->building)) {
+      building++;
+      continue;
+    }
+    UI_SetContext(w->ctx);
+    if (UI_AcquireFrame()) {
+      RenderFrame(w);
+    }
+    w->built = false;
+  }
+  return building;
+}
+
+// Sleeps until the next frame is needed. Frames keep coming while any window
+// is building, has a frame to present, or is animating, and for one more
+// after any input or frame request, which lets the UI settle. Otherwise the
+// loop waits for the next event.
+void WaitForFrame() {
+  bool needed = UI_TakeFrameRequest() || input_received;
+  input_received = false;
+  for (i32 i = 0; i < windows_length && !needed; i++) {
+    Window *w = &windows[i];
+    u32 deadline;
+    if (w->closed) {
+      continue;
+    }
+    // A deadline in the past still needs the frame that settles the tweens,
+    // which clears it.
+    needed = (w->built && !render_thread) || SDL_AtomicGet(&w->building) ||
+             UI_GetAnimationDeadline(w->ctx, &deadline);
+  }
+  if (!needed) {
+    SDL_WaitEvent(NULL);
+  }
+}
+
+i32 main(i32 argc, char *argv[]) {
+  const char *record = NULL;
+  const char *replay = NULL;
+  // Frames after which allocating is reported, or -1 without the audit.
+  i32 audit_warmup = -1;
+  i32 window_count = 1;
+  for (i32 i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--bench") == 0) {
+      UI_Benchmark();
+      return EXIT_SUCCESS;
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replay = argv[++i];
+    } else if (strcmp(argv[i], "--tiled") == 0 && i + 2 < argc) {
+      const char *path = argv[++i];
+      i32 width = 0;
+      i32 height = 0;
+      sscanf(argv[++i], "%dx%d", &width, &height);
+      tiled = UI_OpenRawImage(path, width, height);
+      if (tiled == NULL) {
+        HandleSDLError("Failed to open the tiled image");
+      }
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      record = argv[++i];
+    } else if (strcmp(argv[i], "--windows") == 0 && i + 1 < argc) {
+      window_count = atoi(argv[++i]);
+      window_count = SDL_clamp(window_count, 1, MAX_WINDOWS);
+    } else if (strcmp(argv[i], "--render-thread") == 0) {
+      render_thread = true;
+    } else if (strcmp(argv[i], "--gallery") == 0 && i + 1 < argc) {
+      gallery = argv[++i];
+    } else if (strcmp(argv[i], "--software") == 0) {
+      software = true;
+    } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+      build_budget = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--audit") == 0 && i + 1 < argc) {
+      audit_warmup = atoi(argv[++i]);
+    }
+  }
+
+  // Before anything is allocated.
+  if (audit_warmup >= 0 && !UI_InstallAllocAudit()) {
+    HandleSDLError("Failed to install the allocation audit");
+  }
 
+  // Replayed after the other options, which change what's built.
+  if (replay != NULL) {
+    UI_Context *ctx = UI_CreateContext(NULL, NULL);
+    if (ctx == NULL) {
+      HandleSDLError("UI_CreateContext");
+    }
+    UI_SetContext(ctx);
+    bool ok = UI_Replay(replay, BuildDemo, audit_warmup);
+    UI_DestroyContext(ctx);
+    UI_CloseRawImage(tiled);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  InitSDL();
+  for (i32 i = 0; i < window_count; i++) {
+    char title[32];
+    snprintf(title, sizeof(title), "SDL Window %d", i + 1);
+    OpenWindow(title);
+  }
+  // Only the first window is recorded.
+  UI_SetContext(windows[0].ctx);
+  if (record != NULL && !UI_BeginRecording(record)) {
+    HandleSDLError("Failed to open recording");
+  }
+
+  pool = UI_CreateThreadPool(SDL_min(window_count, SDL_GetCPUCount()));
+  layout_pool = UI_CreateThreadPool(SDL_GetCPUCount());
+  frames_built = SDL_CreateSemaphore(0);
+  if (pool == NULL || layout_pool == NULL || frames_built == NULL) {
+    HandleSDLError("Failed to start the build threads");
+  }
+  // Separate from the builds, so a slow decode never holds up a frame.
+  decoders = UI_CreateThreadPool(SDL_GetCPUCount());
+  if (decoders == NULL) {
+    HandleSDLError("Failed to start the image decoders");
+  }
+  for (i32 i = 0; i < window_count; i++) {
+    UI_SetContext(windows[i].ctx);
+    UI_SetImageDecoder(decoders);
+    UI_SetBuildBudget(build_budget);
+  }
+  telemetry_thread = SDL_CreateThread(TelemetryThread, "Telemetry", &windows[0]);
+  if (telemetry_thread == NULL) {
+    HandleSDLError("Failed to start the telemetry thread");
+  }
+  camera_thread = SDL_CreateThread(CameraThread, "Camera", NULL);
+  if (camera_thread == NULL) {
+    HandleSDLError("Failed to start the camera thread");
+  }
+  if (render_thread) {
+    renderers_created = SDL_CreateSemaphore(0);
+    render_thread_handle = SDL_CreateThread(RenderThread, "Render", NULL);
+    if (renderers_created == NULL || render_thread_handle == NULL) {
+      HandleSDLError("Failed to start the render thread");
+    }
+    SDL_SemWait(renderers_created);
+  } else {
+    for (i32 i = 0; i < window_count; i++) {
+      CreateRenderer(&windows[i]);
+    }
+  }
+
+  UI_TakeAllocStats();
+  i32 frame = 0;
+  while (PollInput()) {
+    // The last frame's allocations, by the builds, decoders and camera too.
+    if (audit_warmup >= 0) {
+      UI_AllocStats stats = UI_TakeAllocStats();
+      if (frame > audit_warmup && stats.allocs > 0) {
+        UI_PrintAllocStats(frame - 1, &stats);
+      }
+    }
+    frame++;
+    u32 deadline = SDL_GetTicks() + FRAME_MS;
+    StartBuilds();
+    UpdateTitles();
+    if (render_thread) {
+      // The render thread presents each frame once built, the next frame is
+      // built meanwhile.
+      i32 remaining = (i32)(deadline - SDL_GetTicks());
+      if (remaining > 0) {
+        SDL_Delay(remaining);
+      }
+      WaitForFrame();
+      continue;
+    }
+    // Present each window as soon as it's built, up to the frame deadline. A
+    // window that misses it is presented once done, without holding up the
+    // others.
+    while (PresentBuilt() > 0) {
+      i32 remaining = (i32)(deadline - SDL_GetTicks());
+      if (remaining <= 0 || SDL_SemWaitTimeout(frames_built, remaining) == SDL_MUTEX_TIMEDOUT) {
+        break;
+      }
+    }
+
+    // Throttle FPS.
+    i32 remaining = (i32)(deadline - SDL_GetTicks());
+    if (remaining > 0) {
+      SDL_Delay(remaining);
+    }
+    WaitForFrame();
+  }
+
+  UI_DestroyThreadPool(pool);
+  UI_DestroyThreadPool(layout_pool);
+  UI_DestroyThreadPool(decoders);
+  SDL_AtomicSet(&telemetry_quit, 1);
+  SDL_WaitThread(telemetry_thread, NULL);
+  SDL_AtomicSet(&camera_quit, 1);
+  SDL_WaitThread(camera_thread, NULL);
+  if (render_thread) {
+    SDL_AtomicSet(&render_thread_quit, 1);
+    SDL_SemPost(frames_built);
+    SDL_WaitThread(render_thread_handle, NULL);
+    SDL_DestroySemaphore(renderers_created);
+  } else {
+    for (i32 i = 0; i < windows_length; i++) {
+      DestroyRenderer(&windows[i]);
+    }
+  }
+  SDL_DestroySemaphore(frames_built);
+  CloseWindows();
+  UI_CloseRawImage(tiled);
   return EXIT_SUCCESS;
 }